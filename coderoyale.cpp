@@ -10,19 +10,309 @@
 #include <deque>
 #include <map>
 #include <thread>
+#include <atomic>
+#include <bitset>
+#include <cstring>
+#include <type_traits>
+#include <cstdint>
+#include <limits>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-//#define PRINT_DEBUG_INPUT
-#ifdef PRINT_DEBUG_INPUT
-#define DBG_INPUT(x) {std::cerr << x << std::endl;}
-#else
-#define DBG_INPUT(x)
+enum class LogLevel
+{
+    ERROR=0,
+    WARN=1,
+    INFO=2,
+    DEBUG=3
+};
+
+// Records above this level are compiled out.
+#ifndef CODEROYALE_LOG_LEVEL
+#define CODEROYALE_LOG_LEVEL 2
 #endif
 
+// Debug output is recorded as typed binary values in a preallocated ring and only formatted when
+// drained, once the turn's commands are sent. A record that does not fit is dropped and counted.
+class DebugLog
+{
+public:
+    static constexpr int capacity = 1 << 18;
+    static constexpr int maxRecordSize = 1024;
+
+    enum class Item : uint8_t
+    {
+        END=0,
+        TEXT=1,
+        CHAR=2,
+        INT=3,
+        UINT=4,
+        DOUBLE=5,
+        WRAP=6,
+        UINT_HEX=7
+    };
+
+    DebugLog() : _buffer(new uint8_t[capacity]), _head(0), _tail(0), _recordStart(-1), _dropped(0) {}
+
+    static DebugLog& instance()
+    {
+        static thread_local DebugLog log;
+        return log;
+    }
+
+    inline void beginRecord(LogLevel level)
+    {
+        _recordStart = -1;
+        if(!reserve(maxRecordSize))
+        {
+            ++_dropped;
+            return;
+        }
+        _recordStart = _head;
+        _buffer[_head++] = static_cast<uint8_t>(level);
+    }
+
+    inline void endRecord()
+    {
+        if(_recordStart >= 0)
+        {
+            _buffer[_head++] = static_cast<uint8_t>(Item::END);
+            _recordStart = -1;
+        }
+    }
+
+    inline void text(const char* str, size_t length)
+    {
+        length = std::min<size_t>(length, spaceInRecord(1 + sizeof(uint16_t)));
+        if(_recordStart < 0)
+        {
+            return;
+        }
+        const uint16_t size = static_cast<uint16_t>(length);
+        _buffer[_head++] = static_cast<uint8_t>(Item::TEXT);
+        std::memcpy(_buffer.get() + _head, &size, sizeof(size));
+        std::memcpy(_buffer.get() + _head + sizeof(size), str, length);
+        _head += sizeof(size) + length;
+    }
+
+    template<typename T>
+    inline void value(Item item, T val)
+    {
+        if(_recordStart < 0 || spaceInRecord(1) < sizeof(val))
+        {
+            return;
+        }
+        _buffer[_head++] = static_cast<uint8_t>(item);
+        std::memcpy(_buffer.get() + _head, &val, sizeof(val));
+        _head += sizeof(val);
+    }
+
+    // Formats every pending record, one line each, and writes them with as few syscalls as possible.
+    void drain(int fd)
+    {
+        char out[8192];
+        size_t used = 0;
+        auto append = [&](const char* str, size_t length)
+        {
+            while(length > 0)
+            {
+                if(used == sizeof(out))
+                {
+                    writeAll(fd, out, used);
+                    used = 0;
+                }
+                const size_t chunk = std::min(length, sizeof(out) - used);
+                std::memcpy(out + used, str, chunk);
+                used += chunk;
+                str += chunk;
+                length -= chunk;
+            }
+        };
+
+        static const char* levelPrefix[] = {"[E] ", "[W] ", "", "[D] "};
+        char number[32];
+        while(_tail != _head)
+        {
+            const uint8_t level = _buffer[_tail++];
+            if(level == static_cast<uint8_t>(Item::WRAP))
+            {
+                _tail = 0;
+                continue;
+            }
+            const char* prefix = levelPrefix[std::min<int>(level, 3)];
+            append(prefix, std::strlen(prefix));
+            for(Item item = static_cast<Item>(_buffer[_tail++]); item != Item::END; item = static_cast<Item>(_buffer[_tail++]))
+            {
+                switch (item)
+                {
+                    case Item::TEXT:
+                    {
+                        uint16_t size;
+                        std::memcpy(&size, _buffer.get() + _tail, sizeof(size));
+                        append(reinterpret_cast<const char*>(_buffer.get() + _tail + sizeof(size)), size);
+                        _tail += sizeof(size) + size;
+                        break;
+                    }
+                    case Item::CHAR:
+                        append(reinterpret_cast<const char*>(_buffer.get() + _tail), 1);
+                        _tail += 1;
+                        break;
+                    case Item::INT:
+                    {
+                        long long val;
+                        std::memcpy(&val, _buffer.get() + _tail, sizeof(val));
+                        append(number, std::snprintf(number, sizeof(number), "%lld", val));
+                        _tail += sizeof(val);
+                        break;
+                    }
+                    case Item::UINT:
+                    {
+                        unsigned long long val;
+                        std::memcpy(&val, _buffer.get() + _tail, sizeof(val));
+                        append(number, std::snprintf(number, sizeof(number), "%llu", val));
+                        _tail += sizeof(val);
+                        break;
+                    }
+                    case Item::UINT_HEX:
+                    {
+                        unsigned long long val;
+                        std::memcpy(&val, _buffer.get() + _tail, sizeof(val));
+                        append(number, std::snprintf(number, sizeof(number), "%016llx", val));
+                        _tail += sizeof(val);
+                        break;
+                    }
+                    case Item::DOUBLE:
+                    {
+                        double val;
+                        std::memcpy(&val, _buffer.get() + _tail, sizeof(val));
+                        append(number, std::snprintf(number, sizeof(number), "%g", val));
+                        _tail += sizeof(val);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            append("\n", 1);
+        }
+        _head = 0;
+        _tail = 0;
+        if(_dropped > 0)
+        {
+            append(number, std::snprintf(number, sizeof(number), "[LOG] %d records dropped\n", _dropped));
+            _dropped = 0;
+        }
+        writeAll(fd, out, used);
+    }
+
+private:
+    // Makes room for size contiguous bytes at _head, wrapping to the start of the ring if needed.
+    inline bool reserve(int size)
+    {
+        if(_head == _tail)
+        {
+            _head = 0;
+            _tail = 0;
+        }
+        if(_head >= _tail)
+        {
+            if(capacity - _head > size)
+            {
+                return true;
+            }
+            if(_tail <= size)
+            {
+                return false;
+            }
+            _buffer[_head] = static_cast<uint8_t>(Item::WRAP);
+            _head = 0;
+        }
+        return _tail - _head > size;
+    }
+
+    // Bytes left for payload in the current record, keeping room for its END marker.
+    inline size_t spaceInRecord(size_t overhead) const
+    {
+        const int left = maxRecordSize - (_head - _recordStart) - 1 - static_cast<int>(overhead);
+        return left > 0 ? static_cast<size_t>(left) : 0;
+    }
+
+    static void writeAll(int fd, const char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            const ssize_t written = ::write(fd, data, size);
+            if(written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(written <= 0)
+            {
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    std::unique_ptr<uint8_t[]> _buffer;
+    int _head;
+    int _tail;
+    int _recordStart;
+    int _dropped;
+};
+
+// Logs an unsigned value as 16 hex digits - LogRecord takes no stream manipulators.
+struct LogHex
+{
+    unsigned long long value;
+};
+
+// One log line, built by streaming values into it like an ostream.
+class LogRecord
+{
+public:
+    explicit LogRecord(LogLevel level) : _log(DebugLog::instance()) { _log.beginRecord(level); }
+    ~LogRecord() { _log.endRecord(); }
+
+    inline LogRecord& operator<<(const char* str) { _log.text(str, std::strlen(str)); return *this; }
+    inline LogRecord& operator<<(const std::string& str) { _log.text(str.data(), str.size()); return *this; }
+    inline LogRecord& operator<<(char c) { _log.value(DebugLog::Item::CHAR, c); return *this; }
+    inline LogRecord& operator<<(bool val) { return *this << (val ? "1" : "0"); }
+    inline LogRecord& operator<<(double val) { _log.value(DebugLog::Item::DOUBLE, val); return *this; }
+    inline LogRecord& operator<<(LogHex hex) { _log.value(DebugLog::Item::UINT_HEX, hex.value); return *this; }
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    inline LogRecord& operator<<(T val) { _log.value(DebugLog::Item::INT, static_cast<long long>(val)); return *this; }
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, int>::type = 0>
+    inline LogRecord& operator<<(T val) { _log.value(DebugLog::Item::UINT, static_cast<unsigned long long>(val)); return *this; }
+
+private:
+    DebugLog& _log;
+};
+
+#ifndef CODEROYALE_QUIET
 #define PRINT_DEBUG_INFO
+#endif
 #ifdef PRINT_DEBUG_INFO
-#define DBG_INFO(x) {std::cerr << x << std::endl;}
+#define DBG_LOG(level, x) {if constexpr(static_cast<int>(level) <= CODEROYALE_LOG_LEVEL) {LogRecord(level) << x;}}
+#else
+// still type-checks the arguments, so values only logged don't show up as unused
+#define DBG_LOG(level, x) {if(false) {LogRecord(level) << x;}}
+#endif
+#define DBG_ERROR(x) DBG_LOG(LogLevel::ERROR, x)
+#define DBG_WARN(x) DBG_LOG(LogLevel::WARN, x)
+#define DBG_INFO(x) DBG_LOG(LogLevel::INFO, x)
+
+//#define PRINT_DEBUG_INPUT
+#ifdef PRINT_DEBUG_INPUT
+#define DBG_INPUT(x) {LogRecord(LogLevel::DEBUG) << x;}
 #else
-#define DBG_INFO(x)
+#define DBG_INPUT(x)
 #endif
 
 using namespace std::chrono_literals;
@@ -46,7 +336,7 @@ enum class StructureType
 };
 
 
-inline std::string structureTypeToString(StructureType sType)
+inline const char* structureTypeToString(StructureType sType)
 {
     switch(sType)
     {
@@ -66,7 +356,7 @@ inline std::string structureTypeToString(StructureType sType)
     return "";
 }
 
-inline std::string unitTypeToString(UnitType uType)
+inline const char* unitTypeToString(UnitType uType)
 {
     switch(uType)
     {
@@ -79,463 +369,5232 @@ inline std::string unitTypeToString(UnitType uType)
         case UnitType::QUEEN:
             return "QUEEN";
     }
+    return "";
 }
 
-
-struct Position
-{
-    Position(): x(0), y(0){}
-    Position(int xPos, int yPos): x(xPos), y(yPos){}
-
-    int x;
-    int y;
-};
-
-class ObjectWithPositionAndRadius
+// Reads stdin in large blocks and parses integers straight out of the buffer.
+// Uses read(2) rather than fread so a partially filled pipe doesn't block the turn.
+class InputReader
 {
 public:
-    ObjectWithPositionAndRadius(const Position& pos) : _pos(pos), _radius(0) {}
-    ObjectWithPositionAndRadius(const Position& pos, int radius) : _pos(pos), _radius(radius) {}
-
-    virtual ~ObjectWithPositionAndRadius(){}
+    explicit InputReader(int fd = STDIN_FILENO) : _fd(fd), _pos(0), _len(0), _eof(false) {}
 
-    inline int distanceTo(const ObjectWithPositionAndRadius& other)
+    inline int readInt()
     {
-        int retVal = static_cast<int>(std::sqrt(
-                                          (other._pos.x - _pos.x)*(other._pos.x - _pos.x) +
-                                          (other._pos.y - _pos.y)*(other._pos.y - _pos.y)
-                                          ) - (_radius + other._radius)
-                                      );
-        /*DBG_INFO("[ObjectWithPositionAndRadius::distanceTo]: (" <<
-                 _pos.x << "," << _pos.y << ") to (" <<
-                 other._pos.x << "," << other._pos.y << ") = " << retVal);*/
-        return retVal;
+        int c = nextChar();
+        while(c != '-' && (c < '0' || c > '9'))
+        {
+            if(c < 0)
+            {
+                _eof = true;
+                return 0;
+            }
+            c = nextChar();
+        }
+        bool negative = false;
+        if(c == '-')
+        {
+            negative = true;
+            c = nextChar();
+        }
+        int value = 0;
+        while(c >= '0' && c <= '9')
+        {
+            value = value * 10 + (c - '0');
+            c = nextChar();
+        }
+        return negative ? -value : value;
     }
 
-    inline const Position& getPosition() const { return _pos; }
-    inline int getRadius() const { return _radius; }
-protected:
-    Position _pos;
-    int _radius;
-};
-
+    inline bool eof() const { return _eof; }
 
+    // Blocks until at least one unread byte is buffered. Returns false at end of input.
+    inline bool waitForData()
+    {
+        if(_pos == _len && !refill())
+        {
+            _eof = true;
+            return false;
+        }
+        return true;
+    }
 
+private:
+    inline int nextChar()
+    {
+        if(_pos == _len && !refill())
+        {
+            return -1;
+        }
+        return static_cast<unsigned char>(_buffer[_pos++]);
+    }
 
-struct StructureInitialInfo
-{
-    Position pos;
-    int radius;
-};
+    bool refill()
+    {
+        ssize_t bytesRead;
+        do
+        {
+            bytesRead = ::read(_fd, _buffer, sizeof(_buffer));
+        } while(bytesRead < 0 && errno == EINTR);
 
-using SiteInfoMap = std::map<int, StructureInitialInfo>;
+        _pos = 0;
+        _len = bytesRead > 0 ? static_cast<size_t>(bytesRead) : 0;
+        return _len > 0;
+    }
 
-class Structure : public ObjectWithPositionAndRadius
-{
-public:
-    Structure(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, StructureType sType, int siteId) :
-        ObjectWithPositionAndRadius(pos, radius),
-        _goldAvailable(goldAvailable),
-        _maxMineSize(maxMineSize),
-        _sType(sType),
-        _team(team),
-        _siteId(siteId) {}
-
-    virtual ~Structure(){}
-
-    void print(){ DBG_INFO("[S] - (" << _pos.x << "," << _pos.y << "), radius: " << _radius
-                           << ", id: " << _siteId << ", team: " << _team << ", type: " << structureTypeToString(_sType)
-                           << ", goldAvl: " << _goldAvailable << ", maxMineSize: " << _maxMineSize);}
-    static std::shared_ptr<Structure> createStructureFromInput(const SiteInfoMap& siteInfo);
-
-    inline int getGoldAvailable() const { return _goldAvailable; }
-    inline int getMaxMineSize() const { return _maxMineSize; }
-    inline StructureType getType() const { return _sType; }
-    inline int getTeam() const { return _team; }
-    inline int getSiteId() const { return _siteId; }
-protected:
-    int _goldAvailable;
-    int _maxMineSize;
-    StructureType _sType;
-    int _team;
-    int _siteId;
-};
-
-class EmptySite : public Structure
-{
-public:
-    EmptySite(const Position& pos, int radius, int goldAvailable, int maxMineSize, int siteId) :
-        Structure(pos, radius, goldAvailable, maxMineSize, -1, StructureType::EMPTY_SITE, siteId) {}
-    virtual ~EmptySite(){}
+    int _fd;
+    size_t _pos;
+    size_t _len;
+    bool _eof;
+    char _buffer[1 << 16];
 };
 
-class Tower : public Structure
+// Collects the command lines of a turn and writes them with a single syscall.
+class OutputWriter
 {
 public:
-    Tower(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, int health, int attackRadius, int siteId) :
-        Structure(pos, radius, goldAvailable, maxMineSize, team, StructureType::TOWER, siteId), _health(health), _attackRadius(attackRadius) {}
-    virtual ~Tower(){}
+    explicit OutputWriter(int fd = STDOUT_FILENO) : _fd(fd), _len(0) {}
 
-    inline int getHealth() const { return _health; }
+    inline OutputWriter& operator<<(const char* text)
+    {
+        while(*text && _len < sizeof(_buffer))
+        {
+            _buffer[_len++] = *text++;
+        }
+        return *this;
+    }
 
-protected:
-    int _health;
-    int _attackRadius;
-};
+    inline OutputWriter& operator<<(char c)
+    {
+        if(_len < sizeof(_buffer))
+        {
+            _buffer[_len++] = c;
+        }
+        return *this;
+    }
 
-class Mine : public Structure
-{
-public:
-    Mine(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, int income,  int siteId) :
-        Structure(pos, radius, goldAvailable, maxMineSize, team, StructureType::MINE, siteId), _income(income) {}
-    virtual ~Mine(){}
+    inline OutputWriter& operator<<(int value)
+    {
+        char digits[12];
+        int nbDigits = 0;
+        unsigned int absValue = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+        do
+        {
+            digits[nbDigits++] = static_cast<char>('0' + absValue % 10);
+            absValue /= 10;
+        } while(absValue != 0);
+        if(value < 0)
+        {
+            *this << '-';
+        }
+        while(nbDigits > 0)
+        {
+            *this << digits[--nbDigits];
+        }
+        return *this;
+    }
 
-    inline int getMineSize() const { return _income; }
+    // A negative descriptor discards the output - used when the bot is driven in-process.
+    void flush()
+    {
+        if(_fd < 0)
+        {
+            _len = 0;
+            return;
+        }
+        size_t written = 0;
+        while(written < _len)
+        {
+            ssize_t ret = ::write(_fd, _buffer + written, _len - written);
+            if(ret < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            written += static_cast<size_t>(ret);
+        }
+        _len = 0;
+    }
 
-protected:
-    int _income;
+private:
+    int _fd;
+    size_t _len;
+    char _buffer[1024];
 };
 
-class Barracks : public Structure
+struct Position
 {
-public:
-    Barracks(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, StructureType sType, int siteId, int turnsUntilTrain) :
-        Structure(pos, radius, goldAvailable, maxMineSize, team, sType, siteId),
-        _turnsUntilTrain(turnsUntilTrain) {}
-    virtual ~Barracks(){}
+    Position(): x(0), y(0){}
+    Position(int xPos, int yPos): x(xPos), y(yPos){}
 
-    inline int getTurnsUntilTrain() const { return _turnsUntilTrain; }
-private:
-    int _turnsUntilTrain;
+    inline bool operator==(const Position& other) const { return x == other.x && y == other.y; }
+    inline bool operator!=(const Position& other) const { return !(*this == other); }
+
+    int x;
+    int y;
 };
 
-class BarracksArchers : public Barracks
+// Edge-to-edge distance between two circles, truncated the same way the strategy always did.
+inline int distanceBetween(const Position& a, int radiusA, const Position& b, int radiusB)
 {
-public:
-    BarracksArchers(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, int siteId, int turnsUntilTrain) :
-        Barracks(pos, radius, goldAvailable, maxMineSize, team, StructureType::BARRACKS_ARCHER, siteId, turnsUntilTrain) {}
-    virtual ~BarracksArchers(){}
-};
+    return static_cast<int>(std::sqrt((b.x - a.x)*(b.x - a.x) + (b.y - a.y)*(b.y - a.y)) - (radiusA + radiusB));
+}
 
-class BarracksKnights : public Barracks
+// Radius the strategy uses for units - only the queen is treated as a circle.
+inline int unitRadius(UnitType uType)
 {
-public:
-    BarracksKnights(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, int siteId, int turnsUntilTrain) :
-        Barracks(pos, radius, goldAvailable, maxMineSize, team, StructureType::BARRACKS_KNIGHT, siteId, turnsUntilTrain) {}
-    virtual ~BarracksKnights(){}
-};
+    return uType == UnitType::QUEEN ? 30 : 0;
+}
 
-class BarracksGiants : public Barracks
+constexpr int MAX_SITES = 32;
+constexpr int MAX_UNITS = 128;
+
+// Flat snapshot of one turn. Sites are indexed by site id, units by their order in the turn input.
+// It is trivially copyable so lookahead code can clone it with a single memcpy.
+struct GameState
 {
-public:
-    BarracksGiants(const Position& pos, int radius, int goldAvailable, int maxMineSize, int team, int siteId, int turnsUntilTrain) :
-        Barracks(pos, radius, goldAvailable, maxMineSize, team, StructureType::BARRACKS_GIANT, siteId, turnsUntilTrain) {}
-    virtual ~BarracksGiants(){}
-};
+    struct Sites
+    {
+        int x[MAX_SITES];
+        int y[MAX_SITES];
+        int radius[MAX_SITES];
+        int gold[MAX_SITES];
+        int maxMineSize[MAX_SITES];
+        StructureType type[MAX_SITES];
+        int owner[MAX_SITES]; // -1 = No structure, 0 = Friendly, 1 = Enemy
+        int param1[MAX_SITES]; // in case of barracks - turns until train, in case of tower - hp, in case of mine - income rate
+        int param2[MAX_SITES]; // in case of tower - attack radius
+    };
 
+    struct Units
+    {
+        int x[MAX_UNITS];
+        int y[MAX_UNITS];
+        int owner[MAX_UNITS];
+        UnitType type[MAX_UNITS];
+        int hp[MAX_UNITS];
+    };
 
+    inline Position sitePosition(int siteId) const { return Position(sites.x[siteId], sites.y[siteId]); }
+    inline Position unitPosition(int unitIdx) const { return Position(units.x[unitIdx], units.y[unitIdx]); }
 
-std::shared_ptr<Structure> Structure::createStructureFromInput(const SiteInfoMap& siteInfo)
-{
-    std::shared_ptr<Structure> retVal;
-    int siteId;
-    int goldAvailable; // used in future leagues
-    int maxMineSize; // used in future leagues
-    int structureType; // -1 = No structure, 1 = Tower, 2 = Barracks
-    int owner; // -1 = No structure, 0 = Friendly, 1 = Enemy
-    int param1; // in case of barracks - turns until train, in case of tower - hp, in case of mine - income rate
-    int param2; // in case of barracks - barrack type - 0 for KNIGHT, 1 for ARCHER, in case of tower - attack radius
+    void printSite(int siteId) const
+    {
+        DBG_INFO("[S] - (" << sites.x[siteId] << "," << sites.y[siteId] << "), radius: " << sites.radius[siteId]
+                 << ", id: " << siteId << ", team: " << sites.owner[siteId] << ", type: " << structureTypeToString(sites.type[siteId])
+                 << ", goldAvl: " << sites.gold[siteId] << ", maxMineSize: " << sites.maxMineSize[siteId]);
+    }
+
+    int turn;
+    int gold[2]; // the enemy's gold is not part of the input and stays an estimate
+    int touchedSite[2];
+    int numSites;
+    int numUnits;
+    Sites sites;
+    Units units;
+};
 
-    std::cin >> siteId >> goldAvailable >> maxMineSize >> structureType >> owner >> param1 >> param2; std::cin.ignore();
-    DBG_INPUT(siteId << " " << goldAvailable << " " << maxMineSize << " " << structureType << " " << owner << " " << param1 << " " << param2);
+static_assert(std::is_trivially_copyable<GameState>::value, "GameState is cloned with memcpy");
 
-    SiteInfoMap::const_iterator it = siteInfo.find(siteId);
+// Fixed-capacity list of site ids or unit indices into a GameState.
+template<int Capacity>
+class IndexList
+{
+public:
+    IndexList() : _size(0) {}
 
-    if(it != siteInfo.end())
+    inline void clear() { _size = 0; }
+    inline void push(int idx)
     {
-        const Position& pos = it->second.pos;
-        int radius = it->second.radius;
-        switch (structureType)
+        if(_size < Capacity)
         {
-            case -1:
-                retVal = std::make_shared<EmptySite>(pos, radius, goldAvailable, maxMineSize, siteId);
-                break;
-            case 0:
-                retVal = std::make_shared<Mine>(pos, radius, goldAvailable, maxMineSize, owner, param1, siteId);
-                break;
-            case 1:
-                retVal = std::make_shared<Tower>(pos, radius, goldAvailable, maxMineSize, owner, param1, param2, siteId);
-                break;
-            case 2:
+            _ids[_size++] = static_cast<uint8_t>(idx);
+        }
+    }
+    // Order is not kept - the last id takes the place of the removed one.
+    inline void remove(int idx)
+    {
+        for(int pos = 0; pos < _size; ++pos)
+        {
+            if(_ids[pos] == idx)
             {
-                switch (param2)
-                {
-                    case 0:
-                        retVal = std::make_shared<BarracksKnights>(pos, radius, goldAvailable, maxMineSize, owner, siteId, param1);
-                        break;
-                    case 1:
-                        retVal = std::make_shared<BarracksArchers>(pos, radius, goldAvailable, maxMineSize, owner, siteId, param1);
-                        break;
-                    case 2:
-                        retVal = std::make_shared<BarracksGiants>(pos, radius, goldAvailable, maxMineSize, owner, siteId, param1);
-                        break;
-                }
+                _ids[pos] = _ids[--_size];
+                return;
             }
         }
     }
-    return retVal;
-}
-
-class Unit : public ObjectWithPositionAndRadius
-{
-public:
-    Unit(const Position& pos, int radius, int team, UnitType uType, int health) :
-        ObjectWithPositionAndRadius (pos, radius),
-        _team(team),
-        _unitType(uType),
-        _health(health) {}
+    inline int size() const { return _size; }
+    inline bool empty() const { return _size == 0; }
+    inline int front() const { return _ids[0]; }
+    inline int operator[](int pos) const { return _ids[pos]; }
 
-    static std::shared_ptr<Unit> createUnitFromInput();
+    inline uint8_t* begin() { return _ids; }
+    inline uint8_t* end() { return _ids + _size; }
+    inline const uint8_t* begin() const { return _ids; }
+    inline const uint8_t* end() const { return _ids + _size; }
 
-    inline UnitType getType() const { return _unitType; }
-    inline int getTeam() const { return _team; }
-    inline int getHealth() const { return _health; }
 private:
-    int _team;
-    UnitType _unitType;
-    int _health;
+    int _size;
+    uint8_t _ids[Capacity];
 };
 
-class Queen : public Unit
-{
-public:
-    Queen(const Position& pos, int team, int health) : Unit(pos, 30, team, UnitType::QUEEN, health) {}
-    virtual ~Queen(){}
-private:
-};
+using SiteList = IndexList<MAX_SITES>;
+using UnitList = IndexList<MAX_UNITS>;
 
-class Archer : public Unit
-{
-public:
-    Archer(const Position& pos, int team, int health) : Unit(pos, 0, team, UnitType::ARCHER, health) {}
-    virtual ~Archer(){}
-};
+// Batched range counting: counts[q] = number of targets t with
+// |query q - target t| < queryReach[q] + targetRadius[t], on squared integer distances.
+// Query arrays are processed in blocks of 8 and must be padded up to a multiple of 8.
+using CountInRangeKernel = void (*)(const int* qx, const int* qy, const int* qReach, int nbQueries,
+                                    const int* tx, const int* ty, const int* tRadius, int nbTargets,
+                                    int* counts);
+
+constexpr int RANGE_BATCH_LANES = 8;
 
-class Knight : public Unit
+inline void countInRangeScalar(const int* qx, const int* qy, const int* qReach, int nbQueries,
+                               const int* tx, const int* ty, const int* tRadius, int nbTargets,
+                               int* counts)
 {
-public:
-    Knight(const Position& pos, int team, int health) : Unit(pos, 0, team, UnitType::KNIGHT, health) {}
-    virtual ~Knight(){}
-};
+    for(int query = 0; query < nbQueries; ++query)
+    {
+        int count = 0;
+        for(int target = 0; target < nbTargets; ++target)
+        {
+            const int dx = tx[target] - qx[query];
+            const int dy = ty[target] - qy[query];
+            const int reach = qReach[query] + tRadius[target];
+            count += dx*dx + dy*dy < reach*reach ? 1 : 0;
+        }
+        counts[query] = count;
+    }
+}
 
-class Giant : public Unit
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+inline void countInRangeAvx2(const int* qx, const int* qy, const int* qReach, int nbQueries,
+                             const int* tx, const int* ty, const int* tRadius, int nbTargets,
+                             int* counts)
 {
-public:
-    Giant(const Position& pos, int team, int health) : Unit(pos, 0, team, UnitType::GIANT, health) {}
-    virtual ~Giant(){}
-};
+    for(int query = 0; query < nbQueries; query += 8)
+    {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qx + query));
+        const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qy + query));
+        const __m256i reach = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qReach + query));
+        __m256i count = _mm256_setzero_si256();
+        for(int target = 0; target < nbTargets; ++target)
+        {
+            const __m256i dx = _mm256_sub_epi32(_mm256_set1_epi32(tx[target]), x);
+            const __m256i dy = _mm256_sub_epi32(_mm256_set1_epi32(ty[target]), y);
+            const __m256i distSq = _mm256_add_epi32(_mm256_mullo_epi32(dx, dx), _mm256_mullo_epi32(dy, dy));
+            const __m256i r = _mm256_add_epi32(reach, _mm256_set1_epi32(tRadius[target]));
+            // the comparison yields -1 in every lane that is in range
+            count = _mm256_sub_epi32(count, _mm256_cmpgt_epi32(_mm256_mullo_epi32(r, r), distSq));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts + query), count);
+    }
+}
 
-std::shared_ptr<Unit> Unit::createUnitFromInput()
+__attribute__((target("sse4.1")))
+inline void countInRangeSse41(const int* qx, const int* qy, const int* qReach, int nbQueries,
+                              const int* tx, const int* ty, const int* tRadius, int nbTargets,
+                              int* counts)
 {
-    std::shared_ptr<Unit> retVal;
-    int x;
-    int y;
-    int owner;
-    int unitTypeInt; // -1 = QUEEN, 0 = KNIGHT, 1 = ARCHER
-    int health;
-    std::cin >> x >> y >> owner >> unitTypeInt >> health; std::cin.ignore();
-    DBG_INPUT(x << " " << y << " " << owner << " " << unitTypeInt << " " << health);
-    Position pos(x,y);
-    switch (unitTypeInt)
-    {
-        case -1:
-            retVal = std::make_shared<Queen>(pos, owner, health);
-            break;
-        case 0:
-            retVal = std::make_shared<Knight>(pos, owner, health);
-            break;
-        case 1:
-            retVal = std::make_shared<Archer>(pos, owner, health);
-            break;
-        case 2:
-            retVal = std::make_shared<Giant>(pos, owner, health);
-            break;
-        default:
-            DBG_INFO("[Unit::createUnitFromInput] Unexpected unit type: " << unitTypeInt);
-            return nullptr;
-    }
-
-    return retVal;
+    for(int query = 0; query < nbQueries; query += 4)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qx + query));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qy + query));
+        const __m128i reach = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qReach + query));
+        __m128i count = _mm_setzero_si128();
+        for(int target = 0; target < nbTargets; ++target)
+        {
+            const __m128i dx = _mm_sub_epi32(_mm_set1_epi32(tx[target]), x);
+            const __m128i dy = _mm_sub_epi32(_mm_set1_epi32(ty[target]), y);
+            const __m128i distSq = _mm_add_epi32(_mm_mullo_epi32(dx, dx), _mm_mullo_epi32(dy, dy));
+            const __m128i r = _mm_add_epi32(reach, _mm_set1_epi32(tRadius[target]));
+            count = _mm_sub_epi32(count, _mm_cmpgt_epi32(_mm_mullo_epi32(r, r), distSq));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(counts + query), count);
+    }
+}
+#endif
+
+inline CountInRangeKernel selectCountInRangeKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return countInRangeAvx2;
+    }
+    if(__builtin_cpu_supports("sse4.1"))
+    {
+        return countInRangeSse41;
+    }
+#endif
+    return countInRangeScalar;
+}
+
+inline void countInRangeBatch(const int* qx, const int* qy, const int* qReach, int nbQueries,
+                              const int* tx, const int* ty, const int* tRadius, int nbTargets,
+                              int* counts)
+{
+    static const CountInRangeKernel kernel = selectCountInRangeKernel();
+    const int paddedQueries = (nbQueries + RANGE_BATCH_LANES - 1) / RANGE_BATCH_LANES * RANGE_BATCH_LANES;
+    kernel(qx, qy, qReach, paddedQueries, tx, ty, tRadius, nbTargets, counts);
 }
 
-template <int Width, int Height>
+// Points laid out as separate coordinate arrays, padded for countInRangeBatch.
+template<int Capacity>
+struct PointBatch
+{
+    static_assert(Capacity % RANGE_BATCH_LANES == 0, "PointBatch capacity has to be a whole number of SIMD blocks");
+
+    PointBatch()
+    {
+        clear();
+    }
+
+    inline void clear()
+    {
+        size = 0;
+        std::fill(x, x + Capacity, 0);
+        std::fill(y, y + Capacity, 0);
+        std::fill(radius, radius + Capacity, 0);
+    }
+
+    inline void push(int px, int py, int pRadius)
+    {
+        if(size < Capacity)
+        {
+            x[size] = px;
+            y[size] = py;
+            radius[size] = pRadius;
+            ++size;
+        }
+    }
+
+    alignas(32) int x[Capacity];
+    alignas(32) int y[Capacity];
+    alignas(32) int radius[Capacity];
+    int size;
+};
+
+
+// Coarse bucket grid over the field. Each cell keeps an intrusive list of the entries inside it,
+// so "who is near this point" only walks the cells overlapping the query circle.
+template <int Width, int Height, int CellSize = 100, int Capacity = MAX_UNITS>
 class Map
 {
 public:
-    Map();
-    ~Map();
+    static constexpr int nbColumns = (Width + CellSize - 1) / CellSize;
+    static constexpr int nbRows = (Height + CellSize - 1) / CellSize;
+    static constexpr int nbCells = nbColumns * nbRows;
+
+    Map()
+    {
+        clear();
+    }
+
+    inline void clear()
+    {
+        std::fill(_cellHead, _cellHead + nbCells, static_cast<int16_t>(-1));
+    }
+
+    inline void insert(int id, int x, int y)
+    {
+        if(id < 0 || id >= Capacity)
+        {
+            return;
+        }
+        const int cell = cellAt(x, y);
+        _x[id] = x;
+        _y[id] = y;
+        _next[id] = _cellHead[cell];
+        _cellHead[cell] = static_cast<int16_t>(id);
+    }
+
+    static inline int columnOf(int x) { return std::max(0, std::min(nbColumns - 1, x / CellSize)); }
+    static inline int rowOf(int y) { return std::max(0, std::min(nbRows - 1, y / CellSize)); }
+    static inline int cellAt(int x, int y) { return rowOf(y) * nbColumns + columnOf(x); }
+
+    // First entry of the bucket containing (x,y), -1 if it's empty. Continue with next().
+    inline int firstInCell(int cell) const { return _cellHead[cell]; }
+    inline int next(int id) const { return _next[id]; }
+
+    // Calls visitor(id) for each entry strictly closer than reach to (x,y).
+    template<typename Visitor>
+    inline void forEachInRange(int x, int y, int reach, Visitor visitor) const
+    {
+        const int reachSq = reach * reach;
+        const int colBegin = columnOf(x - reach);
+        const int colEnd = columnOf(x + reach);
+        const int rowBegin = rowOf(y - reach);
+        const int rowEnd = rowOf(y + reach);
+        for(int row = rowBegin; row <= rowEnd; ++row)
+        {
+            for(int col = colBegin; col <= colEnd; ++col)
+            {
+                for(int id = _cellHead[row * nbColumns + col]; id >= 0; id = _next[id])
+                {
+                    const int dx = _x[id] - x;
+                    const int dy = _y[id] - y;
+                    if(dx*dx + dy*dy < reachSq)
+                    {
+                        visitor(id);
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename Predicate>
+    inline int countInRange(int x, int y, int reach, Predicate predicate) const
+    {
+        int retVal = 0;
+        forEachInRange(x, y, reach, [&](int id)
+        {
+            if(predicate(id))
+            {
+                ++retVal;
+            }
+        });
+        return retVal;
+    }
 
 private:
-    char _array2d[Width*Height];
+    int16_t _cellHead[nbCells];
+    int16_t _next[Capacity];
+    int _x[Capacity];
+    int _y[Capacity];
 };
 
 
 struct TeamState
 {
-    TeamState()
+    TeamState() : queen(-1) {}
+
+    void reset()
     {
-        knights.reserve(40);
-        archers.reserve(40);
-        giants.reserve(40);
-        barracksArchers.reserve(40);
-        barracksKnights.reserve(40);
-        barracksGiants.reserve(40);
-        towers.reserve(40);
-        mines.reserve(40);
+        resetUnits();
+        resetSites();
     }
-    void reset()
+    void resetUnits()
     {
-        queen.reset();
+        queen = -1;
         knights.clear();
         archers.clear();
         giants.clear();
+    }
+    void resetSites()
+    {
         barracksArchers.clear();
         barracksKnights.clear();
         barracksGiants.clear();
         towers.clear();
         mines.clear();
     }
-    std::shared_ptr<Queen> queen;
-    std::vector<std::shared_ptr<Knight>> knights;
-    std::vector<std::shared_ptr<Archer>> archers;
-    std::vector<std::shared_ptr<Giant>> giants;
-    std::vector<std::shared_ptr<BarracksKnights>> barracksKnights;
-    std::vector<std::shared_ptr<BarracksArchers>> barracksArchers;
-    std::vector<std::shared_ptr<BarracksGiants>> barracksGiants;
-    std::vector<std::shared_ptr<Tower>> towers;
-    std::vector<std::shared_ptr<Mine>> mines;
+    // The list holding structures of this type - not meant for EMPTY_SITE.
+    SiteList& sitesOf(StructureType sType)
+    {
+        switch (sType)
+        {
+            case StructureType::BARRACKS_KNIGHT:
+                return barracksKnights;
+            case StructureType::BARRACKS_ARCHER:
+                return barracksArchers;
+            case StructureType::BARRACKS_GIANT:
+                return barracksGiants;
+            case StructureType::MINE:
+                return mines;
+            default:
+                return towers;
+        }
+    }
+    int queen;
+    UnitList knights;
+    UnitList archers;
+    UnitList giants;
+    SiteList barracksKnights;
+    SiteList barracksArchers;
+    SiteList barracksGiants;
+    SiteList towers;
+    SiteList mines;
+};
+
+// What this turn's input changed compared to the previous turn's. Site sets are masks over site ids.
+struct TurnChanges
+{
+    TurnChanges()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        allSites = true;
+        ownerChanged = 0;
+        typeChanged = 0;
+        param1Changed = 0;
+        std::fill(towerHpDelta, towerHpDelta + MAX_SITES, 0);
+        std::memset(unitCountDelta, 0, sizeof(unitCountDelta));
+        queenMoved = true;
+    }
+
+    inline uint32_t structureChanged() const { return ownerChanged | typeChanged; }
+
+    bool allSites;               // nothing to compare with - first turn or a new layout
+    uint32_t ownerChanged;
+    uint32_t typeChanged;
+    uint32_t param1Changed;      // tower hp, barracks countdown or mine income
+    int towerHpDelta[MAX_SITES]; // for towers that stayed towers of the same owner
+    int unitCountDelta[2][4];    // [owner][UnitType] - trained minus killed
+    bool queenMoved;
+};
+
+// The turn's site classification as masks over site ids, filled in while the sites are parsed.
+// Owner 0 is us. Predicates become mask tests and candidates come out with ctz, closest first where a
+// distance-sorted list is walked against the mask.
+struct SiteSets
+{
+    SiteSets()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        empty = 0;
+        friendly = 0;
+        enemy = 0;
+        goldLeft = 0;
+        mines = 0;
+        upgradableMines = 0;
+        weakTowers = 0;
+        readyBarracks = 0;
+        enemyKnightsTraining = 0;
+    }
+
+    void classify(const GameState::Sites& sites, int siteId, int towerDesiredHp)
+    {
+        const uint32_t bit = 1u << siteId;
+        const StructureType sType = sites.type[siteId];
+        const int owner = sites.owner[siteId];
+        const int param1 = sites.param1[siteId];
+        const bool barracks = sType == StructureType::BARRACKS_KNIGHT || sType == StructureType::BARRACKS_ARCHER || sType == StructureType::BARRACKS_GIANT;
+        empty |= sType == StructureType::EMPTY_SITE ? bit : 0;
+        friendly |= owner == 0 ? bit : 0;
+        enemy |= owner == 1 ? bit : 0;
+        goldLeft |= sites.gold[siteId] != 0 ? bit : 0;
+        if(owner == 0)
+        {
+            mines |= sType == StructureType::MINE ? bit : 0;
+            upgradableMines |= sType == StructureType::MINE && param1 < sites.maxMineSize[siteId] ? bit : 0;
+            weakTowers |= sType == StructureType::TOWER && param1 < towerDesiredHp ? bit : 0;
+            readyBarracks |= barracks && param1 <= 0 ? bit : 0;
+        }
+        else if(owner == 1)
+        {
+            enemyKnightsTraining |= sType == StructureType::BARRACKS_KNIGHT && param1 > 0 ? bit : 0;
+        }
+    }
+
+    static inline bool contains(uint32_t mask, int siteId) { return (mask >> siteId) & 1; }
+
+    uint32_t empty;
+    uint32_t friendly;
+    uint32_t enemy;
+    uint32_t goldLeft;              // gold is not known to be exhausted
+    uint32_t mines;                 // ours
+    uint32_t upgradableMines;       // ours, below their maximum size
+    uint32_t weakTowers;            // ours, below the desired hp
+    uint32_t readyBarracks;         // ours, able to train this turn
+    uint32_t enemyKnightsTraining;  // enemy knight barracks with a batch on the way
+};
+
+
+enum class TurnPhase
+{
+    PARSE=0,
+    EVALUATE=1,
+    SEARCH=2,
+    EMIT=3
+};
+
+// Wall clock budget of a turn, measured from the arrival of its first input byte.
+// Each phase gets its own slice and the last few milliseconds are always kept for emitting commands.
+class TurnDeadline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::microseconds firstTurnLimit = 1000ms;
+    static constexpr std::chrono::microseconds turnLimit = 50ms;
+    static constexpr std::chrono::microseconds safetyMargin = 8ms;
+    static constexpr std::chrono::microseconds emitReserve = 2ms;
+    // kept after the search for the training evaluation that still follows it
+    static constexpr std::chrono::microseconds postSearchReserve = 3ms;
+    static constexpr int nbPhases = 4;
+
+    TurnDeadline() : _phase(TurnPhase::PARSE)
+    {
+        startTurn(false);
+    }
+
+    inline void startTurn(bool firstTurn)
+    {
+        _turnStart = Clock::now();
+        _turnEnd = _turnStart + (firstTurn ? firstTurnLimit : turnLimit) - safetyMargin;
+        for(int cnt = 0; cnt < nbPhases; ++cnt)
+        {
+            _phaseElapsed[cnt] = Clock::duration::zero();
+        }
+        _phase = TurnPhase::PARSE;
+        _phaseStart = _turnStart;
+        _phaseEnd = computePhaseEnd(_phase, _phaseStart);
+    }
+
+    inline void beginPhase(TurnPhase phase)
+    {
+        const Clock::time_point now = Clock::now();
+        _phaseElapsed[static_cast<int>(_phase)] += now - _phaseStart;
+        _phase = phase;
+        _phaseStart = now;
+        _phaseEnd = computePhaseEnd(phase, now);
+    }
+
+    inline Clock::time_point turnStart() const { return _turnStart; }
+    inline Clock::time_point turnDeadline() const { return _turnEnd; }
+    inline Clock::time_point phaseDeadline() const { return _phaseEnd; }
+    inline TurnPhase currentPhase() const { return _phase; }
+
+    inline bool phaseExpired() const { return Clock::now() >= _phaseEnd; }
+    // True once only the emit reserve is left - whatever is decided by then has to go out.
+    inline bool mustEmitNow() const { return Clock::now() >= _turnEnd - emitReserve; }
+
+    inline std::chrono::microseconds elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - _turnStart);
+    }
+    inline std::chrono::microseconds phaseElapsed(TurnPhase phase) const
+    {
+        Clock::duration retVal = _phaseElapsed[static_cast<int>(phase)];
+        if(phase == _phase)
+        {
+            retVal += Clock::now() - _phaseStart;
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(retVal);
+    }
+
+private:
+    inline Clock::time_point computePhaseEnd(TurnPhase phase, Clock::time_point phaseStart) const
+    {
+        static constexpr std::chrono::microseconds phaseBudget[nbPhases] =
+        {
+            5ms,  // PARSE
+            5ms,  // EVALUATE
+            0ms,  // SEARCH - everything up to the post search and emit reserves
+            emitReserve   // EMIT
+        };
+        if(phase == TurnPhase::EMIT)
+        {
+            return _turnEnd;
+        }
+        const Clock::time_point latest = _turnEnd - emitReserve - (phase == TurnPhase::SEARCH ? postSearchReserve : 0ms);
+        const std::chrono::microseconds budget = phaseBudget[static_cast<int>(phase)];
+        if(budget == std::chrono::microseconds::zero())
+        {
+            return latest;
+        }
+        return std::min(latest, phaseStart + budget);
+    }
+
+    Clock::time_point _turnStart;
+    Clock::time_point _turnEnd;
+    Clock::time_point _phaseStart;
+    Clock::time_point _phaseEnd;
+    TurnPhase _phase;
+    Clock::duration _phaseElapsed[nbPhases];
+};
+
+
+#ifndef CODEROYALE_NO_PROFILE
+#define PROFILE_TURNS
+#endif
+
+// Raw timestamps for the profiler: the TSC where there is one, converted to time only when reporting.
+inline uint64_t profileTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Log-linear histogram: 8 linear sub-buckets per power of two, so quantiles are within 12.5%.
+class LatencyHistogram
+{
+public:
+    static constexpr int subBits = 3;
+    static constexpr int nbBuckets = (64 - subBits + 1) << subBits;
+
+    LatencyHistogram() : _count(0), _max(0)
+    {
+        std::memset(_counts, 0, sizeof(_counts));
+    }
+
+    inline void record(uint64_t value)
+    {
+        ++_counts[bucketOf(value)];
+        ++_count;
+        _max = std::max(_max, value);
+    }
+
+    inline uint64_t count() const { return _count; }
+    inline uint64_t max() const { return _max; }
+
+    // Upper bound of the bucket holding the q-th quantile, never above the exact maximum.
+    uint64_t quantile(double q) const
+    {
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * _count)));
+        uint64_t seen = 0;
+        for(int bucket = 0; bucket < nbBuckets; ++bucket)
+        {
+            seen += _counts[bucket];
+            if(seen >= rank)
+            {
+                return std::min(_max, bucketUpperBound(bucket));
+            }
+        }
+        return _max;
+    }
+
+private:
+    static inline int bucketOf(uint64_t value)
+    {
+        if(value < (1u << subBits))
+        {
+            return static_cast<int>(value);
+        }
+        const int shift = 63 - __builtin_clzll(value) - subBits;
+        return ((shift + 1) << subBits) + static_cast<int>((value >> shift) & ((1u << subBits) - 1));
+    }
+
+    static inline uint64_t bucketUpperBound(int bucket)
+    {
+        const int group = bucket >> subBits;
+        const uint64_t sub = bucket & ((1u << subBits) - 1);
+        if(group == 0)
+        {
+            return sub;
+        }
+        const int shift = group - 1;
+        return (((1ull << subBits) + sub + 1) << shift) - 1;
+    }
+
+    uint32_t _counts[nbBuckets];
+    uint64_t _count;
+    uint64_t _max;
+};
+
+// Tree of named phases, each with the histogram of its durations over the whole match.
+// Nodes are found by name among the children of the running phase, so the same scope nests wherever it is entered.
+class Profiler
+{
+public:
+    static constexpr int maxNodes = 32;
+
+    static Profiler& instance()
+    {
+        static thread_local Profiler profiler;
+        return profiler;
+    }
+
+    Profiler() : _nbNodes(1), _current(0), _startTicks(profileTicks()), _startTime(std::chrono::steady_clock::now())
+    {
+        _nodes[0].name = "match";
+    }
+
+    // Returns the node of the phase, -1 when the tree is full.
+    inline int enter(const char* name)
+    {
+        int node = _nodes[_current].firstChild;
+        while(node >= 0 && _nodes[node].name != name && std::strcmp(_nodes[node].name, name) != 0)
+        {
+            node = _nodes[node].nextSibling;
+        }
+        if(node < 0)
+        {
+            if(_nbNodes == maxNodes)
+            {
+                return -1;
+            }
+            node = _nbNodes++;
+            _nodes[node].name = name;
+            _nodes[node].parent = _current;
+            _nodes[node].nextSibling = _nodes[_current].firstChild;
+            _nodes[_current].firstChild = node;
+        }
+        _current = node;
+        return node;
+    }
+
+    inline void leave(int node, uint64_t ticks)
+    {
+        _nodes[node].histogram.record(ticks);
+        _current = _nodes[node].parent;
+    }
+
+    void report() const
+    {
+        const double elapsedMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _startTime).count();
+        const double ticksPerMicro = elapsedMicros > 0.0 ? (profileTicks() - _startTicks) / elapsedMicros : 1.0;
+        DBG_INFO("[PROFILE] phase                      count    p50 us    p95 us    p99 us    max us");
+        reportNode(_nodes[0].firstChild, 0, ticksPerMicro);
+    }
+
+private:
+    struct Node
+    {
+        const char* name = "";
+        int parent = 0;
+        int firstChild = -1;
+        int nextSibling = -1;
+        LatencyHistogram histogram;
+    };
+
+    // Siblings are linked newest first, so the list is walked backwards to print them in order of first use.
+    void reportNode(int node, int depth, double ticksPerMicro) const
+    {
+        if(node < 0)
+        {
+            return;
+        }
+        reportNode(_nodes[node].nextSibling, depth, ticksPerMicro);
+        const LatencyHistogram& histogram = _nodes[node].histogram;
+        char line[160];
+        std::snprintf(line, sizeof(line), "%*s%-*s %8llu %9.1f %9.1f %9.1f %9.1f", 2 * depth, "", 26 - 2 * depth, _nodes[node].name,
+                      static_cast<unsigned long long>(histogram.count()),
+                      histogram.quantile(0.50) / ticksPerMicro, histogram.quantile(0.95) / ticksPerMicro,
+                      histogram.quantile(0.99) / ticksPerMicro, histogram.max() / ticksPerMicro);
+        DBG_INFO("[PROFILE] " << line);
+        reportNode(_nodes[node].firstChild, depth + 1, ticksPerMicro);
+    }
+
+    Node _nodes[maxNodes];
+    int _nbNodes;
+    int _current;
+    uint64_t _startTicks;
+    std::chrono::steady_clock::time_point _startTime;
+};
+
+// Times the enclosing block as a phase nested in whichever phase is running.
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name) : _profiler(Profiler::instance()), _node(_profiler.enter(name)), _start(profileTicks()) {}
+    ~ProfileScope()
+    {
+        if(_node >= 0)
+        {
+            _profiler.leave(_node, profileTicks() - _start);
+        }
+    }
+
+private:
+    Profiler& _profiler;
+    int _node;
+    uint64_t _start;
+};
+
+#ifdef PROFILE_TURNS
+#define PROFILE_SCOPE(name) ProfileScope profileScope(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+
+// Code Royale rules used by the simulator.
+constexpr int WORLD_WIDTH = 1920;
+constexpr int WORLD_HEIGHT = 1000;
+constexpr int MAX_TURNS = 250;
+constexpr int CONTACT_RANGE = 5;
+constexpr int QUEEN_SPEED = 60;
+constexpr int QUEEN_RADIUS = 30;
+constexpr int QUEEN_MASS = 10000;
+constexpr int TOWER_HP_INITIAL = 200;
+constexpr int TOWER_HP_INCREMENT = 100;
+constexpr int TOWER_HP_MAXIMUM = 800;
+constexpr int TOWER_MELT_RATE = 4;
+constexpr int TOWER_COVERAGE_PER_HP = 1000;
+constexpr int TOWER_CREEP_DAMAGE_MIN = 3;
+constexpr int TOWER_CREEP_DAMAGE_CLIMB_DISTANCE = 200;
+constexpr int TOWER_QUEEN_DAMAGE_MIN = 1;
+constexpr int TOWER_QUEEN_DAMAGE_CLIMB_DISTANCE = 200;
+constexpr int GIANT_BUST_RATE = 80;
+constexpr int KNIGHT_DAMAGE = 1;
+constexpr int ARCHER_DAMAGE = 2;
+constexpr int ARCHER_DAMAGE_TO_GIANTS = 10;
+constexpr int COLLISION_ITERATIONS = 4;
+
+struct CreepStats
+{
+    int cost;
+    int count;
+    int speed;
+    int range;
+    int radius;
+    int mass;
+    int hp;
+    int buildTime;
+};
+
+inline const CreepStats& creepStats(UnitType uType)
+{
+    static const CreepStats stats[] =
+    {
+        {80, 4, 100, 0, 20, 400, 30, 5},     // KNIGHT
+        {100, 2, 75, 200, 25, 900, 45, 8},   // ARCHER
+        {140, 1, 50, 0, 40, 2000, 200, 10},  // GIANT
+    };
+    return stats[static_cast<int>(uType)];
+}
+
+inline int collisionRadius(UnitType uType)
+{
+    return uType == UnitType::QUEEN ? QUEEN_RADIUS : creepStats(uType).radius;
+}
+
+inline int unitMass(UnitType uType)
+{
+    return uType == UnitType::QUEEN ? QUEEN_MASS : creepStats(uType).mass;
+}
+
+inline int towerAttackRadius(int hp, int siteRadius)
+{
+    return static_cast<int>(std::sqrt((hp * TOWER_COVERAGE_PER_HP + M_PI * siteRadius * siteRadius) / M_PI));
+}
+
+enum class QueenActionType
+{
+    WAIT=0,
+    MOVE=1,
+    BUILD=2
 };
 
+struct QueenAction
+{
+    QueenAction() : type(QueenActionType::WAIT), x(0), y(0), siteId(-1), sType(StructureType::EMPTY_SITE) {}
+
+    static QueenAction wait() { return QueenAction(); }
+    static QueenAction move(const Position& pos)
+    {
+        QueenAction action;
+        action.type = QueenActionType::MOVE;
+        action.x = pos.x;
+        action.y = pos.y;
+        return action;
+    }
+    static QueenAction build(int siteId, StructureType sType)
+    {
+        QueenAction action;
+        action.type = QueenActionType::BUILD;
+        action.siteId = siteId;
+        action.sType = sType;
+        return action;
+    }
+
+    QueenActionType type;
+    int x;
+    int y;
+    int siteId;
+    StructureType sType;
+};
+
+inline bool operator==(const QueenAction& a, const QueenAction& b)
+{
+    if(a.type != b.type)
+    {
+        return false;
+    }
+    switch (a.type)
+    {
+        case QueenActionType::WAIT:
+            return true;
+        case QueenActionType::MOVE:
+            return a.x == b.x && a.y == b.y;
+        case QueenActionType::BUILD:
+            return a.siteId == b.siteId && a.sType == b.sType;
+    }
+    return false;
+}
+
+inline bool operator!=(const QueenAction& a, const QueenAction& b)
+{
+    return !(a == b);
+}
+
+// Everything a player can order in one turn - the queen line and the set of barracks to TRAIN.
+struct PlayerCommands
+{
+    PlayerCommands() : trainMask(0) {}
+
+    QueenAction queen;
+    uint32_t trainMask;
+};
+
+static_assert(MAX_SITES <= 32, "trainMask holds one bit per site");
+
+// Advances a GameState by one turn following the referee's order of resolution:
+// queen actions and training, creep movement, collisions, attacks, aging, then structure upkeep.
+// Owners are absolute (0 and 1) so the same state can be stepped for both players.
+class Simulator
+{
+public:
+    static void step(GameState& state, const PlayerCommands commands[2])
+    {
+        int queens[2];
+        findQueens(state, queens);
+
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            if(queens[owner] >= 0)
+            {
+                applyQueenAction(state, owner, queens[owner], commands[owner].queen);
+            }
+        }
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            applyTraining(state, owner, commands[owner].trainMask);
+        }
+
+        moveCreeps(state, queens);
+        fixCollisions(state);
+        creepsAttack(state, queens);
+        towersAttack(state);
+        ageAndRemoveDead(state);
+        updateStructures(state);
+
+        findQueens(state, queens);
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            state.touchedSite[owner] = queens[owner] >= 0 ? findTouchedSite(state, queens[owner]) : -1;
+        }
+        ++state.turn;
+    }
+
+    static bool isGameOver(const GameState& state)
+    {
+        int queens[2];
+        findQueens(state, queens);
+        return state.turn >= MAX_TURNS || queens[0] < 0 || queens[1] < 0
+                || state.units.hp[queens[0]] <= 0 || state.units.hp[queens[1]] <= 0;
+    }
+
+    // 0 or 1 for the winning owner, -1 for a draw. Only meaningful once isGameOver() holds.
+    static int winner(const GameState& state)
+    {
+        int queens[2];
+        findQueens(state, queens);
+        int hp0 = queens[0] >= 0 ? state.units.hp[queens[0]] : 0;
+        int hp1 = queens[1] >= 0 ? state.units.hp[queens[1]] : 0;
+        if(hp0 == hp1)
+        {
+            return -1;
+        }
+        return hp0 > hp1 ? 0 : 1;
+    }
+
+    static void findQueens(const GameState& state, int queens[2])
+    {
+        queens[0] = -1;
+        queens[1] = -1;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            if(state.units.type[unitIdx] == UnitType::QUEEN)
+            {
+                queens[state.units.owner[unitIdx]] = unitIdx;
+            }
+        }
+    }
+
+    static int findTouchedSite(const GameState& state, int queenIdx)
+    {
+        const int qx = state.units.x[queenIdx];
+        const int qy = state.units.y[queenIdx];
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            const int dx = state.sites.x[siteId] - qx;
+            const int dy = state.sites.y[siteId] - qy;
+            const int touchRange = QUEEN_RADIUS + state.sites.radius[siteId] + CONTACT_RANGE;
+            if(dx*dx + dy*dy < touchRange*touchRange)
+            {
+                return siteId;
+            }
+        }
+        return -1;
+    }
+
+    static inline void moveToward(int& x, int& y, int targetX, int targetY, int speed)
+    {
+        const int dx = targetX - x;
+        const int dy = targetY - y;
+        const int distSq = dx*dx + dy*dy;
+        if(distSq <= speed*speed)
+        {
+            x = targetX;
+            y = targetY;
+            return;
+        }
+        const double scale = speed / std::sqrt(static_cast<double>(distSq));
+        x += static_cast<int>(std::lround(dx * scale));
+        y += static_cast<int>(std::lround(dy * scale));
+    }
+
+    static inline UnitType trainedUnitType(StructureType sType)
+    {
+        switch (sType)
+        {
+            case StructureType::BARRACKS_ARCHER:
+                return UnitType::ARCHER;
+            case StructureType::BARRACKS_GIANT:
+                return UnitType::GIANT;
+            default:
+                return UnitType::KNIGHT;
+        }
+    }
+
+    static inline bool isBarracks(StructureType sType)
+    {
+        return sType == StructureType::BARRACKS_KNIGHT || sType == StructureType::BARRACKS_ARCHER || sType == StructureType::BARRACKS_GIANT;
+    }
+
+private:
+    friend class BatchSimulator;
+
+    static inline int distanceSq(int x1, int y1, int x2, int y2)
+    {
+        return (x2 - x1)*(x2 - x1) + (y2 - y1)*(y2 - y1);
+    }
+
+    static void setEmpty(GameState& state, int siteId)
+    {
+        state.sites.type[siteId] = StructureType::EMPTY_SITE;
+        state.sites.owner[siteId] = -1;
+        state.sites.param1[siteId] = -1;
+        state.sites.param2[siteId] = -1;
+    }
+
+    static void applyQueenAction(GameState& state, int owner, int queenIdx, const QueenAction& action)
+    {
+        GameState::Units& units = state.units;
+        switch (action.type)
+        {
+            case QueenActionType::WAIT:
+                break;
+            case QueenActionType::MOVE:
+                moveToward(units.x[queenIdx], units.y[queenIdx], action.x, action.y, QUEEN_SPEED);
+                break;
+            case QueenActionType::BUILD:
+            {
+                const int siteId = action.siteId;
+                if(siteId < 0 || siteId >= state.numSites)
+                {
+                    break;
+                }
+                if(findTouchedSite(state, queenIdx) != siteId)
+                {
+                    moveToward(units.x[queenIdx], units.y[queenIdx], state.sites.x[siteId], state.sites.y[siteId], QUEEN_SPEED);
+                    break;
+                }
+                build(state, owner, siteId, action.sType);
+                break;
+            }
+        }
+    }
+
+    static void build(GameState& state, int owner, int siteId, StructureType sType)
+    {
+        GameState::Sites& sites = state.sites;
+        buildStructure(sites.type[siteId], sites.owner[siteId], sites.param1[siteId], sites.param2[siteId],
+                       sites.gold[siteId], sites.maxMineSize[siteId], sites.radius[siteId], owner, sType);
+    }
+
+    // The build rules on one site's fields, wherever they are stored.
+    static void buildStructure(StructureType& siteType, int& siteOwner, int& param1, int& param2,
+                               int gold, int maxMineSize, int radius, int owner, StructureType sType)
+    {
+        const bool ownSite = siteOwner == owner;
+        if(siteType == StructureType::TOWER && !ownSite)
+        {
+            return;
+        }
+        switch (sType)
+        {
+            case StructureType::MINE:
+                if(gold == 0)
+                {
+                    return;
+                }
+                if(ownSite && siteType == StructureType::MINE)
+                {
+                    param1 = std::min(param1 + 1, maxMineSize);
+                }
+                else
+                {
+                    param1 = 1;
+                    param2 = -1;
+                }
+                break;
+            case StructureType::TOWER:
+                if(ownSite && siteType == StructureType::TOWER)
+                {
+                    param1 = std::min(param1 + TOWER_HP_INCREMENT, TOWER_HP_MAXIMUM);
+                }
+                else
+                {
+                    param1 = TOWER_HP_INITIAL;
+                }
+                param2 = towerAttackRadius(param1, radius);
+                break;
+            case StructureType::BARRACKS_KNIGHT:
+            case StructureType::BARRACKS_ARCHER:
+            case StructureType::BARRACKS_GIANT:
+                if(ownSite && siteType == sType)
+                {
+                    return;
+                }
+                param1 = 0;
+                param2 = static_cast<int>(sType) - static_cast<int>(StructureType::BARRACKS_KNIGHT);
+                break;
+            case StructureType::EMPTY_SITE:
+                return;
+        }
+        siteType = sType;
+        siteOwner = owner;
+    }
+
+    static void applyTraining(GameState& state, int owner, uint32_t trainMask)
+    {
+        GameState::Sites& sites = state.sites;
+        for(int siteId = 0; trainMask != 0 && siteId < state.numSites; ++siteId, trainMask >>= 1)
+        {
+            if(!(trainMask & 1u) || sites.owner[siteId] != owner || !isBarracks(sites.type[siteId]) || sites.param1[siteId] > 0)
+            {
+                continue;
+            }
+            const CreepStats& stats = creepStats(trainedUnitType(sites.type[siteId]));
+            if(state.gold[owner] < stats.cost)
+            {
+                continue;
+            }
+            state.gold[owner] -= stats.cost;
+            sites.param1[siteId] = stats.buildTime;
+        }
+    }
+
+    static void spawnCreeps(GameState& state, int siteId)
+    {
+        const UnitType uType = trainedUnitType(state.sites.type[siteId]);
+        const CreepStats& stats = creepStats(uType);
+        GameState::Units& units = state.units;
+        for(int cnt = 0; cnt < stats.count && state.numUnits < MAX_UNITS; ++cnt)
+        {
+            const int unitIdx = state.numUnits++;
+            // spread the new creeps a little so the collision pass can separate them
+            units.x[unitIdx] = state.sites.x[siteId] + (cnt & 1 ? 1 : -1) * (cnt + 1);
+            units.y[unitIdx] = state.sites.y[siteId] + (cnt & 2 ? 1 : -1) * (cnt + 1);
+            units.owner[unitIdx] = state.sites.owner[siteId];
+            units.type[unitIdx] = uType;
+            units.hp[unitIdx] = stats.hp;
+        }
+    }
+
+    static int closestEnemyCreep(const GameState& state, int unitIdx)
+    {
+        const GameState::Units& units = state.units;
+        int bestIdx = -1;
+        int bestDistSq = 0;
+        for(int otherIdx = 0; otherIdx < state.numUnits; ++otherIdx)
+        {
+            if(units.owner[otherIdx] == units.owner[unitIdx] || units.type[otherIdx] == UnitType::QUEEN)
+            {
+                continue;
+            }
+            const int distSq = distanceSq(units.x[unitIdx], units.y[unitIdx], units.x[otherIdx], units.y[otherIdx]);
+            if(bestIdx < 0 || distSq < bestDistSq)
+            {
+                bestIdx = otherIdx;
+                bestDistSq = distSq;
+            }
+        }
+        return bestIdx;
+    }
+
+    static int closestEnemyTower(const GameState& state, int unitIdx)
+    {
+        int bestId = -1;
+        int bestDistSq = 0;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            if(state.sites.type[siteId] != StructureType::TOWER || state.sites.owner[siteId] == state.units.owner[unitIdx])
+            {
+                continue;
+            }
+            const int distSq = distanceSq(state.units.x[unitIdx], state.units.y[unitIdx], state.sites.x[siteId], state.sites.y[siteId]);
+            if(bestId < 0 || distSq < bestDistSq)
+            {
+                bestId = siteId;
+                bestDistSq = distSq;
+            }
+        }
+        return bestId;
+    }
+
+    static void moveCreeps(GameState& state, const int queens[2])
+    {
+        GameState::Units& units = state.units;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            const UnitType uType = units.type[unitIdx];
+            if(uType == UnitType::QUEEN)
+            {
+                continue;
+            }
+            const int owner = units.owner[unitIdx];
+            int targetX = units.x[unitIdx];
+            int targetY = units.y[unitIdx];
+            switch (uType)
+            {
+                case UnitType::KNIGHT:
+                {
+                    const int enemyQueen = queens[1 - owner];
+                    if(enemyQueen >= 0)
+                    {
+                        targetX = units.x[enemyQueen];
+                        targetY = units.y[enemyQueen];
+                    }
+                    break;
+                }
+                case UnitType::ARCHER:
+                {
+                    const int targetIdx = closestEnemyCreep(state, unitIdx);
+                    const int followIdx = targetIdx >= 0 ? targetIdx : queens[owner];
+                    if(followIdx >= 0)
+                    {
+                        targetX = units.x[followIdx];
+                        targetY = units.y[followIdx];
+                    }
+                    break;
+                }
+                case UnitType::GIANT:
+                {
+                    const int towerId = closestEnemyTower(state, unitIdx);
+                    if(towerId >= 0)
+                    {
+                        targetX = state.sites.x[towerId];
+                        targetY = state.sites.y[towerId];
+                    }
+                    break;
+                }
+                case UnitType::QUEEN:
+                    break;
+            }
+            moveToward(units.x[unitIdx], units.y[unitIdx], targetX, targetY, creepStats(uType).speed);
+        }
+    }
+
+    static void fixCollisions(GameState& state)
+    {
+        GameState::Units& units = state.units;
+        const GameState::Sites& sites = state.sites;
+        for(int iteration = 0; iteration < COLLISION_ITERATIONS; ++iteration)
+        {
+            bool collided = false;
+            for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+            {
+                const int radius = collisionRadius(units.type[unitIdx]);
+                for(int otherIdx = unitIdx + 1; otherIdx < state.numUnits; ++otherIdx)
+                {
+                    const int minDist = radius + collisionRadius(units.type[otherIdx]);
+                    const int dx = units.x[otherIdx] - units.x[unitIdx];
+                    const int dy = units.y[otherIdx] - units.y[unitIdx];
+                    const int distSq = dx*dx + dy*dy;
+                    if(distSq >= minDist*minDist)
+                    {
+                        continue;
+                    }
+                    collided = true;
+                    const double dist = distSq > 0 ? std::sqrt(static_cast<double>(distSq)) : 1.0;
+                    const double nx = distSq > 0 ? dx / dist : 1.0;
+                    const double ny = distSq > 0 ? dy / dist : 0.0;
+                    const double overlap = minDist - dist;
+                    const int mass = unitMass(units.type[unitIdx]);
+                    const int otherMass = unitMass(units.type[otherIdx]);
+                    const double share = static_cast<double>(otherMass) / (mass + otherMass);
+                    units.x[unitIdx] -= static_cast<int>(std::lround(nx * overlap * share));
+                    units.y[unitIdx] -= static_cast<int>(std::lround(ny * overlap * share));
+                    units.x[otherIdx] += static_cast<int>(std::lround(nx * overlap * (1.0 - share)));
+                    units.y[otherIdx] += static_cast<int>(std::lround(ny * overlap * (1.0 - share)));
+                }
+                for(int siteId = 0; siteId < state.numSites; ++siteId)
+                {
+                    const int minDist = radius + sites.radius[siteId];
+                    const int dx = units.x[unitIdx] - sites.x[siteId];
+                    const int dy = units.y[unitIdx] - sites.y[siteId];
+                    const int distSq = dx*dx + dy*dy;
+                    if(distSq >= minDist*minDist)
+                    {
+                        continue;
+                    }
+                    collided = true;
+                    const double dist = distSq > 0 ? std::sqrt(static_cast<double>(distSq)) : 1.0;
+                    const double nx = distSq > 0 ? dx / dist : 1.0;
+                    const double ny = distSq > 0 ? dy / dist : 0.0;
+                    units.x[unitIdx] = sites.x[siteId] + static_cast<int>(std::ceil(nx * minDist));
+                    units.y[unitIdx] = sites.y[siteId] + static_cast<int>(std::ceil(ny * minDist));
+                }
+                units.x[unitIdx] = std::max(radius, std::min(WORLD_WIDTH - radius, units.x[unitIdx]));
+                units.y[unitIdx] = std::max(radius, std::min(WORLD_HEIGHT - radius, units.y[unitIdx]));
+            }
+            if(!collided)
+            {
+                break;
+            }
+        }
+    }
+
+    static void creepsAttack(GameState& state, const int queens[2])
+    {
+        GameState::Units& units = state.units;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            const int owner = units.owner[unitIdx];
+            switch (units.type[unitIdx])
+            {
+                case UnitType::KNIGHT:
+                {
+                    const int enemyQueen = queens[1 - owner];
+                    if(enemyQueen < 0)
+                    {
+                        break;
+                    }
+                    const int reach = creepStats(UnitType::KNIGHT).radius + QUEEN_RADIUS + CONTACT_RANGE;
+                    if(distanceSq(units.x[unitIdx], units.y[unitIdx], units.x[enemyQueen], units.y[enemyQueen]) < reach*reach)
+                    {
+                        units.hp[enemyQueen] -= KNIGHT_DAMAGE;
+                    }
+                    break;
+                }
+                case UnitType::ARCHER:
+                {
+                    const int targetIdx = closestEnemyCreep(state, unitIdx);
+                    if(targetIdx < 0)
+                    {
+                        break;
+                    }
+                    const int reach = creepStats(UnitType::ARCHER).range + collisionRadius(units.type[targetIdx]);
+                    if(distanceSq(units.x[unitIdx], units.y[unitIdx], units.x[targetIdx], units.y[targetIdx]) < reach*reach)
+                    {
+                        units.hp[targetIdx] -= units.type[targetIdx] == UnitType::GIANT ? ARCHER_DAMAGE_TO_GIANTS : ARCHER_DAMAGE;
+                    }
+                    break;
+                }
+                case UnitType::GIANT:
+                {
+                    const int towerId = closestEnemyTower(state, unitIdx);
+                    if(towerId < 0)
+                    {
+                        break;
+                    }
+                    const int reach = creepStats(UnitType::GIANT).radius + state.sites.radius[towerId] + CONTACT_RANGE;
+                    if(distanceSq(units.x[unitIdx], units.y[unitIdx], state.sites.x[towerId], state.sites.y[towerId]) < reach*reach)
+                    {
+                        state.sites.param1[towerId] -= GIANT_BUST_RATE;
+                    }
+                    break;
+                }
+                case UnitType::QUEEN:
+                    break;
+            }
+        }
+    }
+
+    static void towersAttack(GameState& state)
+    {
+        GameState::Units& units = state.units;
+        const GameState::Sites& sites = state.sites;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            if(sites.type[siteId] != StructureType::TOWER || sites.param1[siteId] <= 0)
+            {
+                continue;
+            }
+            const int attackRadius = sites.param2[siteId];
+            int creepTarget = -1;
+            int creepDistSq = 0;
+            int queenTarget = -1;
+            int queenDistSq = 0;
+            for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+            {
+                if(units.owner[unitIdx] == sites.owner[siteId])
+                {
+                    continue;
+                }
+                const int distSq = distanceSq(sites.x[siteId], sites.y[siteId], units.x[unitIdx], units.y[unitIdx]);
+                if(distSq >= attackRadius*attackRadius)
+                {
+                    continue;
+                }
+                if(units.type[unitIdx] == UnitType::QUEEN)
+                {
+                    queenTarget = unitIdx;
+                    queenDistSq = distSq;
+                }
+                else if(creepTarget < 0 || distSq < creepDistSq)
+                {
+                    creepTarget = unitIdx;
+                    creepDistSq = distSq;
+                }
+            }
+            if(creepTarget >= 0)
+            {
+                const int dist = static_cast<int>(std::sqrt(static_cast<double>(creepDistSq)));
+                units.hp[creepTarget] -= TOWER_CREEP_DAMAGE_MIN + (attackRadius - dist) / TOWER_CREEP_DAMAGE_CLIMB_DISTANCE;
+            }
+            else if(queenTarget >= 0)
+            {
+                const int dist = static_cast<int>(std::sqrt(static_cast<double>(queenDistSq)));
+                units.hp[queenTarget] -= TOWER_QUEEN_DAMAGE_MIN + (attackRadius - dist) / TOWER_QUEEN_DAMAGE_CLIMB_DISTANCE;
+            }
+        }
+    }
+
+    static void ageAndRemoveDead(GameState& state)
+    {
+        GameState::Units& units = state.units;
+        int kept = 0;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            if(units.type[unitIdx] != UnitType::QUEEN)
+            {
+                --units.hp[unitIdx];
+                if(units.hp[unitIdx] <= 0)
+                {
+                    continue;
+                }
+            }
+            if(kept != unitIdx)
+            {
+                units.x[kept] = units.x[unitIdx];
+                units.y[kept] = units.y[unitIdx];
+                units.owner[kept] = units.owner[unitIdx];
+                units.type[kept] = units.type[unitIdx];
+                units.hp[kept] = units.hp[unitIdx];
+            }
+            ++kept;
+        }
+        state.numUnits = kept;
+    }
+
+    static void updateStructures(GameState& state)
+    {
+        GameState::Sites& sites = state.sites;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            switch (sites.type[siteId])
+            {
+                case StructureType::TOWER:
+                    sites.param1[siteId] -= TOWER_MELT_RATE;
+                    if(sites.param1[siteId] <= 0)
+                    {
+                        setEmpty(state, siteId);
+                    }
+                    else
+                    {
+                        sites.param2[siteId] = towerAttackRadius(sites.param1[siteId], sites.radius[siteId]);
+                    }
+                    break;
+                case StructureType::MINE:
+                {
+                    // negative gold means the amount is unknown - assume the mine keeps producing
+                    int extracted = sites.param1[siteId];
+                    if(sites.gold[siteId] >= 0)
+                    {
+                        extracted = std::min(extracted, sites.gold[siteId]);
+                        sites.gold[siteId] -= extracted;
+                    }
+                    state.gold[sites.owner[siteId]] += extracted;
+                    if(sites.gold[siteId] == 0)
+                    {
+                        setEmpty(state, siteId);
+                    }
+                    break;
+                }
+                case StructureType::BARRACKS_KNIGHT:
+                case StructureType::BARRACKS_ARCHER:
+                case StructureType::BARRACKS_GIANT:
+                    if(sites.param1[siteId] > 0 && --sites.param1[siteId] == 0)
+                    {
+                        spawnCreeps(state, siteId);
+                    }
+                    break;
+                case StructureType::EMPTY_SITE:
+                    break;
+            }
+        }
+    }
+};
+
+
+// Up to eight game states of the same map advanced in lockstep, following exactly the rules of Simulator::step.
+// Every per-state field is stored lane-interleaved - field[slot][lane] - so the inner loops below run across
+// the states and compile to one SIMD operation per slot. Lanes that are not loaded or whose game is over are masked out;
+// the rare per-state work (queen orders, training, spawning, removing the dead) runs lane by lane.
+#define BATCH_PHASE __attribute__((always_inline)) inline
+
+class BatchSimulator
+{
+public:
+    static constexpr int lanes = 8;
+
+    BatchSimulator() : _numSites(0), _activeMask(0)
+    {
+        std::fill(_numUnits, _numUnits + lanes, 0);
+    }
+
+    // Takes the site geometry shared by every lane and empties all lanes.
+    void reset(const GameState& layout)
+    {
+        _numSites = layout.numSites;
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            _siteX[siteId] = layout.sites.x[siteId];
+            _siteY[siteId] = layout.sites.y[siteId];
+            _siteRadius[siteId] = layout.sites.radius[siteId];
+            _siteMaxMineSize[siteId] = layout.sites.maxMineSize[siteId];
+        }
+        _activeMask = 0;
+    }
+
+    // Copies a state of the reset map into a lane, which is active unless its game is already over.
+    void load(int lane, const GameState& state)
+    {
+        _turn[lane] = state.turn;
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            _gold[owner][lane] = state.gold[owner];
+            _touchedSite[owner][lane] = state.touchedSite[owner];
+        }
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            _siteGold[siteId][lane] = state.sites.gold[siteId];
+            _siteType[siteId][lane] = state.sites.type[siteId];
+            _siteOwner[siteId][lane] = state.sites.owner[siteId];
+            _siteParam1[siteId][lane] = state.sites.param1[siteId];
+            _siteParam2[siteId][lane] = state.sites.param2[siteId];
+        }
+        _numUnits[lane] = state.numUnits;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            _unitX[unitIdx][lane] = state.units.x[unitIdx];
+            _unitY[unitIdx][lane] = state.units.y[unitIdx];
+            _unitOwner[unitIdx][lane] = state.units.owner[unitIdx];
+            _unitType[unitIdx][lane] = state.units.type[unitIdx];
+            _unitHp[unitIdx][lane] = state.units.hp[unitIdx];
+            _unitRadius[unitIdx][lane] = collisionRadius(state.units.type[unitIdx]);
+            _unitMass[unitIdx][lane] = unitMass(state.units.type[unitIdx]);
+        }
+        findQueens(lane);
+        if(Simulator::isGameOver(state))
+        {
+            deactivate(lane);
+        }
+        else
+        {
+            _activeMask |= 1u << lane;
+        }
+    }
+
+    void store(int lane, GameState& state) const
+    {
+        state.turn = _turn[lane];
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            state.gold[owner] = _gold[owner][lane];
+            state.touchedSite[owner] = _touchedSite[owner][lane];
+        }
+        state.numSites = _numSites;
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            state.sites.x[siteId] = _siteX[siteId];
+            state.sites.y[siteId] = _siteY[siteId];
+            state.sites.radius[siteId] = _siteRadius[siteId];
+            state.sites.maxMineSize[siteId] = _siteMaxMineSize[siteId];
+            state.sites.gold[siteId] = _siteGold[siteId][lane];
+            state.sites.type[siteId] = _siteType[siteId][lane];
+            state.sites.owner[siteId] = _siteOwner[siteId][lane];
+            state.sites.param1[siteId] = _siteParam1[siteId][lane];
+            state.sites.param2[siteId] = _siteParam2[siteId][lane];
+        }
+        state.numUnits = _numUnits[lane];
+        for(int unitIdx = 0; unitIdx < _numUnits[lane]; ++unitIdx)
+        {
+            state.units.x[unitIdx] = _unitX[unitIdx][lane];
+            state.units.y[unitIdx] = _unitY[unitIdx][lane];
+            state.units.owner[unitIdx] = _unitOwner[unitIdx][lane];
+            state.units.type[unitIdx] = _unitType[unitIdx][lane];
+            state.units.hp[unitIdx] = _unitHp[unitIdx][lane];
+        }
+    }
+
+    inline uint32_t activeMask() const { return _activeMask; }
+    inline void deactivate(int lane) { _activeMask &= ~(1u << lane); }
+
+    // Advances every active lane by one turn with its own pair of commands, then deactivates the lanes whose game is over.
+    void step(const PlayerCommands commands[][2])
+    {
+        static const StepKernel kernel = selectStepKernel();
+        kernel(*this, commands);
+    }
+
+private:
+    using StepKernel = void (*)(BatchSimulator& batch, const PlayerCommands commands[][2]);
+
+    // The same lane loops, compiled once for the baseline instruction set and once for AVX2.
+    static void stepGeneric(BatchSimulator& batch, const PlayerCommands commands[][2])
+    {
+        batch.stepLanes<false>(commands);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2")))
+    static void stepAvx2(BatchSimulator& batch, const PlayerCommands commands[][2])
+    {
+        batch.stepLanes<true>(commands);
+    }
+#endif
+
+    static StepKernel selectStepKernel()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+        {
+            return stepAvx2;
+        }
+#endif
+        return stepGeneric;
+    }
+
+    template<bool avx2>
+    BATCH_PHASE void stepLanes(const PlayerCommands commands[][2])
+    {
+        if(_activeMask == 0)
+        {
+            return;
+        }
+        int slots = 0;
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            _slotLimit[lane] = (_activeMask >> lane) & 1u ? _numUnits[lane] : 0;
+            slots = std::max(slots, _slotLimit[lane]);
+        }
+        for(uint32_t mask = _activeMask; mask != 0; mask &= mask - 1)
+        {
+            const int lane = __builtin_ctz(mask);
+            for(int owner = 0; owner < 2; ++owner)
+            {
+                if(_queen[owner][lane] >= 0)
+                {
+                    applyQueenAction(lane, owner, commands[lane][owner].queen);
+                }
+            }
+            for(int owner = 0; owner < 2; ++owner)
+            {
+                applyTraining(lane, owner, commands[lane][owner].trainMask);
+            }
+        }
+
+        moveCreeps(slots);
+        fixCollisions<avx2>(slots);
+        creepsAttack(slots);
+        towersAttack(slots);
+        ageAndRemoveDead(slots);
+        updateStructures();
+
+        for(uint32_t mask = _activeMask; mask != 0; mask &= mask - 1)
+        {
+            const int lane = __builtin_ctz(mask);
+            findQueens(lane);
+            for(int owner = 0; owner < 2; ++owner)
+            {
+                _touchedSite[owner][lane] = _queen[owner][lane] >= 0 ? findTouchedSite(lane, _queen[owner][lane]) : -1;
+            }
+            ++_turn[lane];
+            const int queen0 = _queen[0][lane];
+            const int queen1 = _queen[1][lane];
+            if(_turn[lane] >= MAX_TURNS || queen0 < 0 || queen1 < 0 || _unitHp[queen0][lane] <= 0 || _unitHp[queen1][lane] <= 0)
+            {
+                deactivate(lane);
+            }
+        }
+    }
+
+    // One bit per lane whose flag is set.
+    static inline uint32_t laneMask(const int* flags)
+    {
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i lowUnset = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(flags)), zero);
+        const __m128i highUnset = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(flags + 4)), zero);
+        const int unset = _mm_movemask_ps(_mm_castsi128_ps(lowUnset)) | _mm_movemask_ps(_mm_castsi128_ps(highUnset)) << 4;
+        return ~static_cast<uint32_t>(unset) & 0xffu;
+#else
+        uint32_t mask = 0;
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            mask |= (flags[lane] ? 1u : 0u) << lane;
+        }
+        return mask;
+#endif
+    }
+
+    void findQueens(int lane)
+    {
+        _queen[0][lane] = -1;
+        _queen[1][lane] = -1;
+        for(int unitIdx = 0; unitIdx < _numUnits[lane]; ++unitIdx)
+        {
+            if(_unitType[unitIdx][lane] == UnitType::QUEEN)
+            {
+                _queen[_unitOwner[unitIdx][lane]][lane] = unitIdx;
+            }
+        }
+    }
+
+    int findTouchedSite(int lane, int queenIdx) const
+    {
+        const int qx = _unitX[queenIdx][lane];
+        const int qy = _unitY[queenIdx][lane];
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            const int dx = _siteX[siteId] - qx;
+            const int dy = _siteY[siteId] - qy;
+            const int touchRange = QUEEN_RADIUS + _siteRadius[siteId] + CONTACT_RANGE;
+            if(dx*dx + dy*dy < touchRange*touchRange)
+            {
+                return siteId;
+            }
+        }
+        return -1;
+    }
+
+    void applyQueenAction(int lane, int owner, const QueenAction& action)
+    {
+        const int queenIdx = _queen[owner][lane];
+        switch (action.type)
+        {
+            case QueenActionType::WAIT:
+                break;
+            case QueenActionType::MOVE:
+                Simulator::moveToward(_unitX[queenIdx][lane], _unitY[queenIdx][lane], action.x, action.y, QUEEN_SPEED);
+                break;
+            case QueenActionType::BUILD:
+            {
+                const int siteId = action.siteId;
+                if(siteId < 0 || siteId >= _numSites)
+                {
+                    break;
+                }
+                if(findTouchedSite(lane, queenIdx) != siteId)
+                {
+                    Simulator::moveToward(_unitX[queenIdx][lane], _unitY[queenIdx][lane], _siteX[siteId], _siteY[siteId], QUEEN_SPEED);
+                    break;
+                }
+                Simulator::buildStructure(_siteType[siteId][lane], _siteOwner[siteId][lane], _siteParam1[siteId][lane], _siteParam2[siteId][lane],
+                                          _siteGold[siteId][lane], _siteMaxMineSize[siteId], _siteRadius[siteId], owner, action.sType);
+                break;
+            }
+        }
+    }
+
+    void applyTraining(int lane, int owner, uint32_t trainMask)
+    {
+        for(int siteId = 0; trainMask != 0 && siteId < _numSites; ++siteId, trainMask >>= 1)
+        {
+            const StructureType sType = _siteType[siteId][lane];
+            if(!(trainMask & 1u) || _siteOwner[siteId][lane] != owner || !Simulator::isBarracks(sType) || _siteParam1[siteId][lane] > 0)
+            {
+                continue;
+            }
+            const CreepStats& stats = creepStats(Simulator::trainedUnitType(sType));
+            if(_gold[owner][lane] < stats.cost)
+            {
+                continue;
+            }
+            _gold[owner][lane] -= stats.cost;
+            _siteParam1[siteId][lane] = stats.buildTime;
+        }
+    }
+
+    void spawnCreeps(int lane, int siteId)
+    {
+        const UnitType uType = Simulator::trainedUnitType(_siteType[siteId][lane]);
+        const CreepStats& stats = creepStats(uType);
+        for(int cnt = 0; cnt < stats.count && _numUnits[lane] < MAX_UNITS; ++cnt)
+        {
+            const int unitIdx = _numUnits[lane]++;
+            _unitX[unitIdx][lane] = _siteX[siteId] + (cnt & 1 ? 1 : -1) * (cnt + 1);
+            _unitY[unitIdx][lane] = _siteY[siteId] + (cnt & 2 ? 1 : -1) * (cnt + 1);
+            _unitOwner[unitIdx][lane] = _siteOwner[siteId][lane];
+            _unitType[unitIdx][lane] = uType;
+            _unitHp[unitIdx][lane] = stats.hp;
+            _unitRadius[unitIdx][lane] = stats.radius;
+            _unitMass[unitIdx][lane] = stats.mass;
+        }
+    }
+
+    // Closest enemy creep of the unit in slot unitIdx, for the lanes that want one - Simulator::closestEnemyCreep across lanes.
+    BATCH_PHASE void closestEnemyCreeps(int unitIdx, int slots, const int* wanted, int* closest) const
+    {
+        int bestDistSq[lanes];
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            closest[lane] = -1;
+            bestDistSq[lane] = 0;
+        }
+        for(int otherIdx = 0; otherIdx < slots; ++otherIdx)
+        {
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const int dx = _unitX[otherIdx][lane] - _unitX[unitIdx][lane];
+                const int dy = _unitY[otherIdx][lane] - _unitY[unitIdx][lane];
+                const int distSq = dx*dx + dy*dy;
+                const bool candidate = wanted[lane] && otherIdx < _slotLimit[lane]
+                        && _unitOwner[otherIdx][lane] != _unitOwner[unitIdx][lane] && _unitType[otherIdx][lane] != UnitType::QUEEN;
+                const bool closer = candidate && (closest[lane] < 0 || distSq < bestDistSq[lane]);
+                closest[lane] = closer ? otherIdx : closest[lane];
+                bestDistSq[lane] = closer ? distSq : bestDistSq[lane];
+            }
+        }
+    }
+
+    BATCH_PHASE void closestEnemyTowers(int unitIdx, const int* wanted, int* closest) const
+    {
+        int bestDistSq[lanes];
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            closest[lane] = -1;
+            bestDistSq[lane] = 0;
+        }
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const int dx = _siteX[siteId] - _unitX[unitIdx][lane];
+                const int dy = _siteY[siteId] - _unitY[unitIdx][lane];
+                const int distSq = dx*dx + dy*dy;
+                const bool candidate = wanted[lane] && _siteType[siteId][lane] == StructureType::TOWER
+                        && _siteOwner[siteId][lane] != _unitOwner[unitIdx][lane];
+                const bool closer = candidate && (closest[lane] < 0 || distSq < bestDistSq[lane]);
+                closest[lane] = closer ? siteId : closest[lane];
+                bestDistSq[lane] = closer ? distSq : bestDistSq[lane];
+            }
+        }
+    }
+
+    BATCH_PHASE void moveCreeps(int slots)
+    {
+        for(int unitIdx = 0; unitIdx < slots; ++unitIdx)
+        {
+            int moves[lanes];
+            int archers[lanes];
+            int giants[lanes];
+            int targetX[lanes];
+            int targetY[lanes];
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const UnitType uType = _unitType[unitIdx][lane];
+                moves[lane] = unitIdx < _slotLimit[lane] && uType != UnitType::QUEEN;
+                archers[lane] = moves[lane] && uType == UnitType::ARCHER;
+                giants[lane] = moves[lane] && uType == UnitType::GIANT;
+                targetX[lane] = _unitX[unitIdx][lane];
+                targetY[lane] = _unitY[unitIdx][lane];
+            }
+            const uint32_t moving = laneMask(moves);
+            if(moving == 0)
+            {
+                continue;
+            }
+            for(uint32_t mask = moving; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                const int enemyQueen = _queen[1 - _unitOwner[unitIdx][lane]][lane];
+                if(_unitType[unitIdx][lane] == UnitType::KNIGHT && enemyQueen >= 0)
+                {
+                    targetX[lane] = _unitX[enemyQueen][lane];
+                    targetY[lane] = _unitY[enemyQueen][lane];
+                }
+            }
+            if(laneMask(archers) != 0)
+            {
+                int closest[lanes];
+                closestEnemyCreeps(unitIdx, slots, archers, closest);
+                for(uint32_t mask = laneMask(archers); mask != 0; mask &= mask - 1)
+                {
+                    const int lane = __builtin_ctz(mask);
+                    const int followIdx = closest[lane] >= 0 ? closest[lane] : _queen[_unitOwner[unitIdx][lane]][lane];
+                    if(followIdx >= 0)
+                    {
+                        targetX[lane] = _unitX[followIdx][lane];
+                        targetY[lane] = _unitY[followIdx][lane];
+                    }
+                }
+            }
+            if(laneMask(giants) != 0)
+            {
+                int closest[lanes];
+                closestEnemyTowers(unitIdx, giants, closest);
+                for(uint32_t mask = laneMask(giants); mask != 0; mask &= mask - 1)
+                {
+                    const int lane = __builtin_ctz(mask);
+                    if(closest[lane] >= 0)
+                    {
+                        targetX[lane] = _siteX[closest[lane]];
+                        targetY[lane] = _siteY[closest[lane]];
+                    }
+                }
+            }
+            for(uint32_t mask = moving; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                Simulator::moveToward(_unitX[unitIdx][lane], _unitY[unitIdx][lane], targetX[lane], targetY[lane],
+                                      creepStats(_unitType[unitIdx][lane]).speed);
+            }
+        }
+    }
+
+    void separateUnits(int lane, int unitIdx, int otherIdx)
+    {
+        const int minDist = _unitRadius[unitIdx][lane] + _unitRadius[otherIdx][lane];
+        const int dx = _unitX[otherIdx][lane] - _unitX[unitIdx][lane];
+        const int dy = _unitY[otherIdx][lane] - _unitY[unitIdx][lane];
+        const int distSq = dx*dx + dy*dy;
+        const double dist = distSq > 0 ? std::sqrt(static_cast<double>(distSq)) : 1.0;
+        const double nx = distSq > 0 ? dx / dist : 1.0;
+        const double ny = distSq > 0 ? dy / dist : 0.0;
+        const double overlap = minDist - dist;
+        const int mass = _unitMass[unitIdx][lane];
+        const int otherMass = _unitMass[otherIdx][lane];
+        const double share = static_cast<double>(otherMass) / (mass + otherMass);
+        _unitX[unitIdx][lane] -= static_cast<int>(std::lround(nx * overlap * share));
+        _unitY[unitIdx][lane] -= static_cast<int>(std::lround(ny * overlap * share));
+        _unitX[otherIdx][lane] += static_cast<int>(std::lround(nx * overlap * (1.0 - share)));
+        _unitY[otherIdx][lane] += static_cast<int>(std::lround(ny * overlap * (1.0 - share)));
+    }
+
+    void pushOutOfSite(int lane, int unitIdx, int siteId)
+    {
+        const int minDist = _unitRadius[unitIdx][lane] + _siteRadius[siteId];
+        const int dx = _unitX[unitIdx][lane] - _siteX[siteId];
+        const int dy = _unitY[unitIdx][lane] - _siteY[siteId];
+        const int distSq = dx*dx + dy*dy;
+        const double dist = distSq > 0 ? std::sqrt(static_cast<double>(distSq)) : 1.0;
+        const double nx = distSq > 0 ? dx / dist : 1.0;
+        const double ny = distSq > 0 ? dy / dist : 0.0;
+        _unitX[unitIdx][lane] = _siteX[siteId] + static_cast<int>(std::ceil(nx * minDist));
+        _unitY[unitIdx][lane] = _siteY[siteId] + static_cast<int>(std::ceil(ny * minDist));
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // std::lround of four doubles - halves away from zero - as whole numbers in doubles.
+    __attribute__((target("avx2")))
+    static inline __m256d roundHalfAway(__m256d value)
+    {
+        const __m256d signMask = _mm256_set1_pd(-0.0);
+        const __m256d truncated = _mm256_round_pd(value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        // the fraction is exact, so exact halves are caught
+        const __m256d fraction = _mm256_andnot_pd(signMask, _mm256_sub_pd(value, truncated));
+        const __m256d unit = _mm256_or_pd(_mm256_and_pd(signMask, value), _mm256_set1_pd(1.0));
+        const __m256d roundsUp = _mm256_cmp_pd(fraction, _mm256_set1_pd(0.5), _CMP_GE_OQ);
+        return _mm256_add_pd(truncated, _mm256_and_pd(roundsUp, unit));
+    }
+
+    // separateUnits for every lane in hits at once, with the same double operations in the same order.
+    __attribute__((target("avx2")))
+    void separateUnitsAvx2(uint32_t hits, int unitIdx, int otherIdx)
+    {
+        const __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitX[unitIdx]));
+        const __m256i y = _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitY[unitIdx]));
+        const __m256i otherX = _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitX[otherIdx]));
+        const __m256i otherY = _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitY[otherIdx]));
+        const __m256i minDist = _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitRadius[unitIdx])),
+                                                 _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitRadius[otherIdx])));
+        const __m256i otherMass = _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitMass[otherIdx]));
+        const __m256i massSum = _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitMass[unitIdx])), otherMass);
+        const __m256i dx = _mm256_sub_epi32(otherX, x);
+        const __m256i dy = _mm256_sub_epi32(otherY, y);
+        const __m256i distSq = _mm256_add_epi32(_mm256_mullo_epi32(dx, dx), _mm256_mullo_epi32(dy, dy));
+
+        __m128i pushed[4][2];  // x and y of the unit, x and y of the other unit - per half
+        for(int half = 0; half < 2; ++half)
+        {
+            if(((hits >> (4 * half)) & 0xfu) == 0)
+            {
+                for(int push = 0; push < 4; ++push)
+                {
+                    pushed[push][half] = _mm_setzero_si128();
+                }
+                continue;
+            }
+            const auto toDouble = [half](__m256i value) -> __m256d
+            {
+                return _mm256_cvtepi32_pd(half == 0 ? _mm256_castsi256_si128(value) : _mm256_extracti128_si256(value, 1));
+            };
+            const __m256d one = _mm256_set1_pd(1.0);
+            const __m256d distSqD = toDouble(distSq);
+            const __m256d apart = _mm256_cmp_pd(distSqD, _mm256_setzero_pd(), _CMP_GT_OQ);
+            const __m256d dist = _mm256_blendv_pd(one, _mm256_sqrt_pd(distSqD), apart);
+            const __m256d nx = _mm256_blendv_pd(one, _mm256_div_pd(toDouble(dx), dist), apart);
+            const __m256d ny = _mm256_blendv_pd(_mm256_setzero_pd(), _mm256_div_pd(toDouble(dy), dist), apart);
+            const __m256d overlap = _mm256_sub_pd(toDouble(minDist), dist);
+            const __m256d share = _mm256_div_pd(toDouble(otherMass), toDouble(massSum));
+            const __m256d otherShare = _mm256_sub_pd(one, share);
+            const __m256d nxOverlap = _mm256_mul_pd(nx, overlap);
+            const __m256d nyOverlap = _mm256_mul_pd(ny, overlap);
+            pushed[0][half] = _mm256_cvtpd_epi32(roundHalfAway(_mm256_mul_pd(nxOverlap, share)));
+            pushed[1][half] = _mm256_cvtpd_epi32(roundHalfAway(_mm256_mul_pd(nyOverlap, share)));
+            pushed[2][half] = _mm256_cvtpd_epi32(roundHalfAway(_mm256_mul_pd(nxOverlap, otherShare)));
+            pushed[3][half] = _mm256_cvtpd_epi32(roundHalfAway(_mm256_mul_pd(nyOverlap, otherShare)));
+        }
+        const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i selected = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(hits)), laneBits), laneBits);
+        const auto apply = [&](int (*field)[lanes], int slot, int push, bool away)
+        {
+            const __m256i delta = _mm256_and_si256(selected, _mm256_set_m128i(pushed[push][1], pushed[push][0]));
+            __m256i* target = reinterpret_cast<__m256i*>(field[slot]);
+            _mm256_store_si256(target, away ? _mm256_sub_epi32(_mm256_load_si256(target), delta)
+                                            : _mm256_add_epi32(_mm256_load_si256(target), delta));
+        };
+        apply(_unitX, unitIdx, 0, true);
+        apply(_unitY, unitIdx, 1, true);
+        apply(_unitX, otherIdx, 2, false);
+        apply(_unitY, otherIdx, 3, false);
+    }
+#endif
+
+    // Lanes where the units in the two slots overlap.
+    template<bool avx2>
+    BATCH_PHASE uint32_t unitOverlaps(int unitIdx, int otherIdx) const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if(avx2)
+        {
+            return unitOverlapsAvx2(unitIdx, otherIdx);
+        }
+#endif
+        int overlaps[lanes];
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            const int minDist = _unitRadius[unitIdx][lane] + _unitRadius[otherIdx][lane];
+            const int dx = _unitX[otherIdx][lane] - _unitX[unitIdx][lane];
+            const int dy = _unitY[otherIdx][lane] - _unitY[unitIdx][lane];
+            overlaps[lane] = dx*dx + dy*dy < minDist*minDist;
+        }
+        return laneMask(overlaps);
+    }
+
+    // Lanes where the unit in the slot overlaps the site.
+    template<bool avx2>
+    BATCH_PHASE uint32_t siteOverlaps(int unitIdx, int siteId) const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if(avx2)
+        {
+            return siteOverlapsAvx2(unitIdx, siteId);
+        }
+#endif
+        int overlaps[lanes];
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            const int minDist = _unitRadius[unitIdx][lane] + _siteRadius[siteId];
+            const int dx = _unitX[unitIdx][lane] - _siteX[siteId];
+            const int dy = _unitY[unitIdx][lane] - _siteY[siteId];
+            overlaps[lane] = dx*dx + dy*dy < minDist*minDist;
+        }
+        return laneMask(overlaps);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("avx2")))
+    static inline uint32_t inRangeMaskAvx2(__m256i dx, __m256i dy, __m256i minDist)
+    {
+        const __m256i distSq = _mm256_add_epi32(_mm256_mullo_epi32(dx, dx), _mm256_mullo_epi32(dy, dy));
+        const __m256i overlaps = _mm256_cmpgt_epi32(_mm256_mullo_epi32(minDist, minDist), distSq);
+        return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(overlaps)));
+    }
+
+    __attribute__((target("avx2")))
+    uint32_t unitOverlapsAvx2(int unitIdx, int otherIdx) const
+    {
+        const __m256i dx = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitX[otherIdx])),
+                                            _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitX[unitIdx])));
+        const __m256i dy = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitY[otherIdx])),
+                                            _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitY[unitIdx])));
+        const __m256i minDist = _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitRadius[unitIdx])),
+                                                 _mm256_load_si256(reinterpret_cast<const __m256i*>(_unitRadius[otherIdx])));
+        return inRangeMaskAvx2(dx, dy, minDist);
+    }
+
+    __attribute__((target("avx2")))
+    uint32_t siteOverlapsAvx2(int unitIdx, int siteId) const
+    {
+        const __m256i dx = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitX[unitIdx])),
+                                            _mm256_set1_epi32(_siteX[siteId]));
+        const __m256i dy = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitY[unitIdx])),
+                                            _mm256_set1_epi32(_siteY[siteId]));
+        const __m256i minDist = _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(_unitRadius[unitIdx])),
+                                                 _mm256_set1_epi32(_siteRadius[siteId]));
+        return inRangeMaskAvx2(dx, dy, minDist);
+    }
+#endif
+
+    // Each lane resolves its overlaps in the order Simulator::fixCollisions does; every overlap test runs across lanes.
+    template<bool avx2>
+    BATCH_PHASE void fixCollisions(int slots)
+    {
+        uint32_t iterating = _activeMask;
+        for(int iteration = 0; iteration < COLLISION_ITERATIONS && iterating != 0; ++iteration)
+        {
+            uint32_t collided = 0;
+            for(int unitIdx = 0; unitIdx < slots; ++unitIdx)
+            {
+                int present[lanes];
+                for(int lane = 0; lane < lanes; ++lane)
+                {
+                    present[lane] = unitIdx < _slotLimit[lane];
+                }
+                const uint32_t presentMask = laneMask(present) & iterating;
+                if(presentMask == 0)
+                {
+                    continue;
+                }
+                // slots beyond a lane's own units hold stale data, so the later slot has to be present as well
+                for(int otherIdx = unitIdx + 1; otherIdx < slots; ++otherIdx)
+                {
+                    for(int lane = 0; lane < lanes; ++lane)
+                    {
+                        present[lane] = otherIdx < _slotLimit[lane];
+                    }
+                    const uint32_t hits = unitOverlaps<avx2>(unitIdx, otherIdx) & laneMask(present) & presentMask;
+                    if(hits == 0)
+                    {
+                        continue;
+                    }
+#if defined(__x86_64__) || defined(__i386__)
+                    if(avx2)
+                    {
+                        separateUnitsAvx2(hits, unitIdx, otherIdx);
+                    }
+                    else
+#endif
+                    {
+                        for(uint32_t mask = hits; mask != 0; mask &= mask - 1)
+                        {
+                            separateUnits(__builtin_ctz(mask), unitIdx, otherIdx);
+                        }
+                    }
+                    collided |= hits;
+                }
+                for(int siteId = 0; siteId < _numSites; ++siteId)
+                {
+                    const uint32_t hits = siteOverlaps<avx2>(unitIdx, siteId) & presentMask;
+                    for(uint32_t mask = hits; mask != 0; mask &= mask - 1)
+                    {
+                        pushOutOfSite(__builtin_ctz(mask), unitIdx, siteId);
+                    }
+                    collided |= hits;
+                }
+                for(int lane = 0; lane < lanes; ++lane)
+                {
+                    const int radius = _unitRadius[unitIdx][lane];
+                    const bool clamps = (presentMask >> lane) & 1u;
+                    const int x = std::max(radius, std::min(WORLD_WIDTH - radius, _unitX[unitIdx][lane]));
+                    const int y = std::max(radius, std::min(WORLD_HEIGHT - radius, _unitY[unitIdx][lane]));
+                    _unitX[unitIdx][lane] = clamps ? x : _unitX[unitIdx][lane];
+                    _unitY[unitIdx][lane] = clamps ? y : _unitY[unitIdx][lane];
+                }
+            }
+            iterating &= collided;
+        }
+    }
+
+    BATCH_PHASE void creepsAttack(int slots)
+    {
+        for(int unitIdx = 0; unitIdx < slots; ++unitIdx)
+        {
+            int knights[lanes];
+            int archers[lanes];
+            int giants[lanes];
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const UnitType uType = _unitType[unitIdx][lane];
+                const bool present = unitIdx < _slotLimit[lane];
+                knights[lane] = present && uType == UnitType::KNIGHT;
+                archers[lane] = present && uType == UnitType::ARCHER;
+                giants[lane] = present && uType == UnitType::GIANT;
+            }
+            for(uint32_t mask = laneMask(knights); mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                const int enemyQueen = _queen[1 - _unitOwner[unitIdx][lane]][lane];
+                if(enemyQueen < 0)
+                {
+                    continue;
+                }
+                const int reach = creepStats(UnitType::KNIGHT).radius + QUEEN_RADIUS + CONTACT_RANGE;
+                const int dx = _unitX[enemyQueen][lane] - _unitX[unitIdx][lane];
+                const int dy = _unitY[enemyQueen][lane] - _unitY[unitIdx][lane];
+                if(dx*dx + dy*dy < reach*reach)
+                {
+                    _unitHp[enemyQueen][lane] -= KNIGHT_DAMAGE;
+                }
+            }
+            if(laneMask(archers) != 0)
+            {
+                int closest[lanes];
+                closestEnemyCreeps(unitIdx, slots, archers, closest);
+                for(uint32_t mask = laneMask(archers); mask != 0; mask &= mask - 1)
+                {
+                    const int lane = __builtin_ctz(mask);
+                    const int targetIdx = closest[lane];
+                    if(targetIdx < 0)
+                    {
+                        continue;
+                    }
+                    const int reach = creepStats(UnitType::ARCHER).range + _unitRadius[targetIdx][lane];
+                    const int dx = _unitX[targetIdx][lane] - _unitX[unitIdx][lane];
+                    const int dy = _unitY[targetIdx][lane] - _unitY[unitIdx][lane];
+                    if(dx*dx + dy*dy < reach*reach)
+                    {
+                        _unitHp[targetIdx][lane] -= _unitType[targetIdx][lane] == UnitType::GIANT ? ARCHER_DAMAGE_TO_GIANTS : ARCHER_DAMAGE;
+                    }
+                }
+            }
+            if(laneMask(giants) != 0)
+            {
+                int closest[lanes];
+                closestEnemyTowers(unitIdx, giants, closest);
+                for(uint32_t mask = laneMask(giants); mask != 0; mask &= mask - 1)
+                {
+                    const int lane = __builtin_ctz(mask);
+                    const int towerId = closest[lane];
+                    if(towerId < 0)
+                    {
+                        continue;
+                    }
+                    const int reach = creepStats(UnitType::GIANT).radius + _siteRadius[towerId] + CONTACT_RANGE;
+                    const int dx = _siteX[towerId] - _unitX[unitIdx][lane];
+                    const int dy = _siteY[towerId] - _unitY[unitIdx][lane];
+                    if(dx*dx + dy*dy < reach*reach)
+                    {
+                        _siteParam1[towerId][lane] -= GIANT_BUST_RATE;
+                    }
+                }
+            }
+        }
+    }
+
+    // Target selection runs across lanes - the closest enemy creep in range, else the enemy queen in range.
+    BATCH_PHASE void towersAttack(int slots)
+    {
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            int towers[lanes];
+            int creepTarget[lanes];
+            int creepDistSq[lanes];
+            int queenTarget[lanes];
+            int queenDistSq[lanes];
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                towers[lane] = ((_activeMask >> lane) & 1u) && _siteType[siteId][lane] == StructureType::TOWER && _siteParam1[siteId][lane] > 0;
+                creepTarget[lane] = -1;
+                creepDistSq[lane] = 0;
+                queenTarget[lane] = -1;
+                queenDistSq[lane] = 0;
+            }
+            const uint32_t firing = laneMask(towers);
+            if(firing == 0)
+            {
+                continue;
+            }
+            for(int unitIdx = 0; unitIdx < slots; ++unitIdx)
+            {
+                for(int lane = 0; lane < lanes; ++lane)
+                {
+                    const int attackRadius = _siteParam2[siteId][lane];
+                    const int dx = _unitX[unitIdx][lane] - _siteX[siteId];
+                    const int dy = _unitY[unitIdx][lane] - _siteY[siteId];
+                    const int distSq = dx*dx + dy*dy;
+                    const bool inRange = towers[lane] && unitIdx < _slotLimit[lane]
+                            && _unitOwner[unitIdx][lane] != _siteOwner[siteId][lane] && distSq < attackRadius*attackRadius;
+                    const bool queen = _unitType[unitIdx][lane] == UnitType::QUEEN;
+                    const bool queenHit = inRange && queen;
+                    const bool creepHit = inRange && !queen && (creepTarget[lane] < 0 || distSq < creepDistSq[lane]);
+                    queenTarget[lane] = queenHit ? unitIdx : queenTarget[lane];
+                    queenDistSq[lane] = queenHit ? distSq : queenDistSq[lane];
+                    creepTarget[lane] = creepHit ? unitIdx : creepTarget[lane];
+                    creepDistSq[lane] = creepHit ? distSq : creepDistSq[lane];
+                }
+            }
+            for(uint32_t mask = firing; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                const int attackRadius = _siteParam2[siteId][lane];
+                if(creepTarget[lane] >= 0)
+                {
+                    const int dist = static_cast<int>(std::sqrt(static_cast<double>(creepDistSq[lane])));
+                    _unitHp[creepTarget[lane]][lane] -= TOWER_CREEP_DAMAGE_MIN + (attackRadius - dist) / TOWER_CREEP_DAMAGE_CLIMB_DISTANCE;
+                }
+                else if(queenTarget[lane] >= 0)
+                {
+                    const int dist = static_cast<int>(std::sqrt(static_cast<double>(queenDistSq[lane])));
+                    _unitHp[queenTarget[lane]][lane] -= TOWER_QUEEN_DAMAGE_MIN + (attackRadius - dist) / TOWER_QUEEN_DAMAGE_CLIMB_DISTANCE;
+                }
+            }
+        }
+    }
+
+    BATCH_PHASE void ageAndRemoveDead(int slots)
+    {
+        int died[lanes] = {};
+        for(int unitIdx = 0; unitIdx < slots; ++unitIdx)
+        {
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const bool ages = unitIdx < _slotLimit[lane] && _unitType[unitIdx][lane] != UnitType::QUEEN;
+                _unitHp[unitIdx][lane] -= ages ? 1 : 0;
+                died[lane] |= ages && _unitHp[unitIdx][lane] <= 0;
+            }
+        }
+        for(uint32_t mask = laneMask(died); mask != 0; mask &= mask - 1)
+        {
+            const int lane = __builtin_ctz(mask);
+            int kept = 0;
+            for(int unitIdx = 0; unitIdx < _numUnits[lane]; ++unitIdx)
+            {
+                if(_unitType[unitIdx][lane] != UnitType::QUEEN && _unitHp[unitIdx][lane] <= 0)
+                {
+                    continue;
+                }
+                if(kept != unitIdx)
+                {
+                    _unitX[kept][lane] = _unitX[unitIdx][lane];
+                    _unitY[kept][lane] = _unitY[unitIdx][lane];
+                    _unitOwner[kept][lane] = _unitOwner[unitIdx][lane];
+                    _unitType[kept][lane] = _unitType[unitIdx][lane];
+                    _unitHp[kept][lane] = _unitHp[unitIdx][lane];
+                    _unitRadius[kept][lane] = _unitRadius[unitIdx][lane];
+                    _unitMass[kept][lane] = _unitMass[unitIdx][lane];
+                }
+                ++kept;
+            }
+            _numUnits[lane] = kept;
+        }
+    }
+
+    // Tower decay, mine income and barracks countdowns across lanes; emptied sites, new tower radii and spawns per lane.
+    BATCH_PHASE void updateStructures()
+    {
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            int emptied[lanes];
+            int decayed[lanes];
+            int spawns[lanes];
+            for(int lane = 0; lane < lanes; ++lane)
+            {
+                const bool active = (_activeMask >> lane) & 1u;
+                const StructureType sType = _siteType[siteId][lane];
+                const bool tower = active && sType == StructureType::TOWER;
+                const bool mine = active && sType == StructureType::MINE;
+                const bool barracks = active && Simulator::isBarracks(sType) && _siteParam1[siteId][lane] > 0;
+                int param1 = _siteParam1[siteId][lane] - (tower ? TOWER_MELT_RATE : 0) - (barracks ? 1 : 0);
+
+                // negative gold means the amount is unknown - assume the mine keeps producing
+                const int goldLeft = _siteGold[siteId][lane];
+                const int extracted = mine ? (goldLeft >= 0 ? std::min(param1, goldLeft) : param1) : 0;
+                const int goldAfter = goldLeft >= 0 ? goldLeft - extracted : goldLeft;
+                const int owner = _siteOwner[siteId][lane];
+                _gold[0][lane] += owner == 0 ? extracted : 0;
+                _gold[1][lane] += owner == 1 ? extracted : 0;
+                _siteGold[siteId][lane] = goldAfter;
+                _siteParam1[siteId][lane] = param1;
+
+                emptied[lane] = (tower && param1 <= 0) || (mine && goldAfter == 0);
+                decayed[lane] = tower && param1 > 0;
+                spawns[lane] = barracks && param1 == 0;
+            }
+            for(uint32_t mask = laneMask(emptied); mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                _siteType[siteId][lane] = StructureType::EMPTY_SITE;
+                _siteOwner[siteId][lane] = -1;
+                _siteParam1[siteId][lane] = -1;
+                _siteParam2[siteId][lane] = -1;
+            }
+            for(uint32_t mask = laneMask(decayed); mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                _siteParam2[siteId][lane] = towerAttackRadius(_siteParam1[siteId][lane], _siteRadius[siteId]);
+            }
+            for(uint32_t mask = laneMask(spawns); mask != 0; mask &= mask - 1)
+            {
+                spawnCreeps(__builtin_ctz(mask), siteId);
+            }
+        }
+    }
+
+    int _numSites;
+    uint32_t _activeMask;
+    int _siteX[MAX_SITES];
+    int _siteY[MAX_SITES];
+    int _siteRadius[MAX_SITES];
+    int _siteMaxMineSize[MAX_SITES];
+
+    alignas(32) int _turn[lanes];
+    alignas(32) int _gold[2][lanes];
+    alignas(32) int _touchedSite[2][lanes];
+    alignas(32) int _queen[2][lanes];
+    alignas(32) int _numUnits[lanes];
+    alignas(32) int _slotLimit[lanes]; // _numUnits for the lanes being stepped, 0 for the others
+    alignas(32) int _siteGold[MAX_SITES][lanes];
+    alignas(32) StructureType _siteType[MAX_SITES][lanes];
+    alignas(32) int _siteOwner[MAX_SITES][lanes];
+    alignas(32) int _siteParam1[MAX_SITES][lanes];
+    alignas(32) int _siteParam2[MAX_SITES][lanes];
+    alignas(32) int _unitX[MAX_UNITS][lanes];
+    alignas(32) int _unitY[MAX_UNITS][lanes];
+    alignas(32) int _unitOwner[MAX_UNITS][lanes];
+    alignas(32) UnitType _unitType[MAX_UNITS][lanes];
+    alignas(32) int _unitHp[MAX_UNITS][lanes];
+    alignas(32) int _unitRadius[MAX_UNITS][lanes];
+    alignas(32) int _unitMass[MAX_UNITS][lanes];
+};
+
+#undef BATCH_PHASE
+
+
+// Static visibility graph around the site circles, so the queen walks around sites instead of sliding along them.
+// Waypoints sit on an octagon around each site, just wide enough for the queen to walk its sides without touching;
+// two waypoints are linked when the segment between them clears every site. Built once per map.
+class PathFinder
+{
+public:
+    static constexpr int waypointsPerSite = 8;
+    static constexpr int maxWaypoints = MAX_SITES * waypointsPerSite;
+    static constexpr float clearance = 2.0f;
+    // extra cost of a waypoint inside an enemy tower's range, for queries that avoid towers
+    static constexpr float towerPenalty = 200.0f;
+
+    PathFinder() : _numSites(0), _nbWaypoints(0), _nbDangerZones(0) {}
+
+    void build(const GameState& state)
+    {
+        _numSites = state.numSites;
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            _cx[siteId] = static_cast<float>(state.sites.x[siteId]);
+            _cy[siteId] = static_cast<float>(state.sites.y[siteId]);
+            _obstacle[siteId] = static_cast<float>(state.sites.radius[siteId] + QUEEN_RADIUS);
+        }
+
+        _nbWaypoints = 0;
+        const float ringScale = 1.0f / std::cos(static_cast<float>(M_PI) / waypointsPerSite);
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            const float ring = _obstacle[siteId] * ringScale + clearance;
+            for(int corner = 0; corner < waypointsPerSite; ++corner)
+            {
+                const float angle = 2.0f * static_cast<float>(M_PI) * corner / waypointsPerSite;
+                const float x = _cx[siteId] + ring * std::cos(angle);
+                const float y = _cy[siteId] + ring * std::sin(angle);
+                if(x < QUEEN_RADIUS || y < QUEEN_RADIUS || x > WORLD_WIDTH - QUEEN_RADIUS || y > WORLD_HEIGHT - QUEEN_RADIUS
+                        || insideMask(x, y) != 0)
+                {
+                    continue;
+                }
+                _wx[_nbWaypoints] = x;
+                _wy[_nbWaypoints] = y;
+                ++_nbWaypoints;
+            }
+        }
+
+        _adjacencyStart.assign(_nbWaypoints + 1, 0);
+        _adjacentTo.clear();
+        _adjacentLength.clear();
+        for(int from = 0; from < _nbWaypoints; ++from)
+        {
+            _adjacencyStart[from] = static_cast<int>(_adjacentTo.size());
+            for(int to = 0; to < _nbWaypoints; ++to)
+            {
+                if(to != from && segmentClear(_wx[from], _wy[from], _wx[to], _wy[to], 0))
+                {
+                    _adjacentTo.push_back(static_cast<uint16_t>(to));
+                    _adjacentLength.push_back(length(_wx[from], _wy[from], _wx[to], _wy[to]));
+                }
+            }
+            _seesSite[from] = 0;
+            for(int siteId = 0; siteId < _numSites; ++siteId)
+            {
+                if(segmentClear(_wx[from], _wy[from], _cx[siteId], _cy[siteId], 1u << siteId))
+                {
+                    _seesSite[from] |= 1u << siteId;
+                }
+            }
+        }
+        _adjacencyStart[_nbWaypoints] = static_cast<int>(_adjacentTo.size());
+        _heap.reserve(_adjacentTo.size() + 2 * maxWaypoints);
+        std::fill(&_siteRoute[0][0], &_siteRoute[0][0] + MAX_SITES * MAX_SITES, -1.0f);
+        _nbDangerZones = 0;
+    }
+
+    // Enemy tower ranges for the queries that avoid them.
+    void setDangerZones(const GameState& state)
+    {
+        _nbDangerZones = 0;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            if(state.sites.owner[siteId] == 1 && state.sites.type[siteId] == StructureType::TOWER)
+            {
+                _dangerX[_nbDangerZones] = _cx[siteId];
+                _dangerY[_nbDangerZones] = _cy[siteId];
+                _dangerRadius[_nbDangerZones] = static_cast<float>(state.sites.param2[siteId]);
+                ++_nbDangerZones;
+            }
+        }
+    }
+
+    // A* from a point to a point. Returns the path length and sets firstStep to the first point to walk to.
+    float route(const Position& from, const Position& to, Position& firstStep, bool avoidTowers)
+    {
+        const Goal goal = {static_cast<float>(to.x), static_cast<float>(to.y), 0.0f, -1};
+        return search(static_cast<float>(from.x), static_cast<float>(from.y), -1, goal, avoidTowers, &firstStep);
+    }
+
+    // A* from a point to contact with a site - the path a BUILD order should follow.
+    float routeToSite(const Position& from, int siteId, Position& firstStep, bool avoidTowers)
+    {
+        const Goal goal = {_cx[siteId], _cy[siteId], _obstacle[siteId], siteId};
+        return search(static_cast<float>(from.x), static_cast<float>(from.y), -1, goal, avoidTowers, &firstStep);
+    }
+
+    // Path length from touching one site to touching another, computed on first use and cached.
+    float siteRouteLength(int from, int to)
+    {
+        if(from == to)
+        {
+            return 0.0f;
+        }
+        float& cached = _siteRoute[from][to];
+        if(cached < 0.0f)
+        {
+            const Goal goal = {_cx[to], _cy[to], _obstacle[to], to};
+            cached = search(_cx[from], _cy[from], from, goal, false, nullptr);
+            _siteRoute[to][from] = cached;
+        }
+        return cached;
+    }
+
+    // Path length from a point to contact with every site, with a single Dijkstra over the graph.
+    // Same scale as distanceBetween(pos, QUEEN_RADIUS, site, radius) when nothing is in the way.
+    void distancesToSites(const Position& from, int distance[MAX_SITES])
+    {
+        const float fx = static_cast<float>(from.x);
+        const float fy = static_cast<float>(from.y);
+        const uint32_t startInside = insideMask(fx, fy);
+        dijkstra(fx, fy, startInside, false);
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            const uint32_t bit = 1u << siteId;
+            float best = std::numeric_limits<float>::max();
+            if(segmentClear(fx, fy, _cx[siteId], _cy[siteId], startInside | bit))
+            {
+                best = length(fx, fy, _cx[siteId], _cy[siteId]) - _obstacle[siteId];
+            }
+            for(int node = 0; node < _nbWaypoints; ++node)
+            {
+                if((_seesSite[node] & bit) && _cost[node] < best)
+                {
+                    best = std::min(best, _cost[node] + length(_wx[node], _wy[node], _cx[siteId], _cy[siteId]) - _obstacle[siteId]);
+                }
+            }
+            distance[siteId] = best == std::numeric_limits<float>::max() ? WORLD_WIDTH + WORLD_HEIGHT : static_cast<int>(std::max(0.0f, best));
+        }
+    }
+
+private:
+    struct Goal
+    {
+        float x;
+        float y;
+        float radius;  // reached at this distance from (x, y)
+        int siteId;    // the goal site does not block the way to itself
+    };
+
+    struct HeapEntry
+    {
+        float priority;
+        int node;
+        bool operator<(const HeapEntry& other) const { return priority > other.priority; }
+    };
+
+    static inline float length(float ax, float ay, float bx, float by)
+    {
+        return std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+    }
+
+    // Sites whose obstacle circle contains the point.
+    inline uint32_t insideMask(float x, float y) const
+    {
+        uint32_t retVal = 0;
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            const float dx = x - _cx[siteId];
+            const float dy = y - _cy[siteId];
+            if(dx * dx + dy * dy < _obstacle[siteId] * _obstacle[siteId])
+            {
+                retVal |= 1u << siteId;
+            }
+        }
+        return retVal;
+    }
+
+    inline bool segmentClear(float ax, float ay, float bx, float by, uint32_t ignored) const
+    {
+        const float dx = bx - ax;
+        const float dy = by - ay;
+        const float lengthSq = dx * dx + dy * dy;
+        for(int siteId = 0; siteId < _numSites; ++siteId)
+        {
+            if(ignored & (1u << siteId))
+            {
+                continue;
+            }
+            float t = lengthSq > 0.0f ? ((_cx[siteId] - ax) * dx + (_cy[siteId] - ay) * dy) / lengthSq : 0.0f;
+            t = std::min(1.0f, std::max(0.0f, t));
+            const float px = ax + t * dx - _cx[siteId];
+            const float py = ay + t * dy - _cy[siteId];
+            const float radius = _obstacle[siteId] - 0.5f;
+            if(px * px + py * py < radius * radius)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline float nodePenalty(int node, bool avoidTowers) const
+    {
+        if(!avoidTowers)
+        {
+            return 0.0f;
+        }
+        for(int zone = 0; zone < _nbDangerZones; ++zone)
+        {
+            const float dx = _wx[node] - _dangerX[zone];
+            const float dy = _wy[node] - _dangerY[zone];
+            if(dx * dx + dy * dy < _dangerRadius[zone] * _dangerRadius[zone])
+            {
+                return towerPenalty;
+            }
+        }
+        return 0.0f;
+    }
+
+    // Seeds _cost with the waypoints visible from the start point and resets the search state.
+    inline void seed(float sx, float sy, uint32_t ignored, bool avoidTowers)
+    {
+        _heap.clear();
+        for(int node = 0; node < _nbWaypoints; ++node)
+        {
+            _cost[node] = std::numeric_limits<float>::max();
+            _parent[node] = -1;
+            _closed[node] = false;
+            if(segmentClear(sx, sy, _wx[node], _wy[node], ignored))
+            {
+                _cost[node] = length(sx, sy, _wx[node], _wy[node]) + nodePenalty(node, avoidTowers);
+            }
+        }
+    }
+
+    void dijkstra(float sx, float sy, uint32_t ignored, bool avoidTowers)
+    {
+        seed(sx, sy, ignored, avoidTowers);
+        for(int node = 0; node < _nbWaypoints; ++node)
+        {
+            if(_cost[node] < std::numeric_limits<float>::max())
+            {
+                pushHeap(_cost[node], node);
+            }
+        }
+        while(!_heap.empty())
+        {
+            const HeapEntry entry = popHeap();
+            if(_closed[entry.node])
+            {
+                continue;
+            }
+            _closed[entry.node] = true;
+            relax(entry.node, avoidTowers, nullptr);
+        }
+    }
+
+    float search(float sx, float sy, int startSite, const Goal& goal, bool avoidTowers, Position* firstStep)
+    {
+        const uint32_t goalBit = goal.siteId >= 0 ? 1u << goal.siteId : 0;
+        const uint32_t ignored = insideMask(sx, sy) | (startSite >= 0 ? 1u << startSite : 0);
+        auto remaining = [&](float x, float y) -> float
+        {
+            return std::max(0.0f, length(x, y, goal.x, goal.y) - goal.radius);
+        };
+        if(firstStep)
+        {
+            *firstStep = Position(static_cast<int>(goal.x), static_cast<int>(goal.y));
+        }
+        if(segmentClear(sx, sy, goal.x, goal.y, ignored | goalBit | insideMask(goal.x, goal.y)))
+        {
+            return remaining(sx, sy);
+        }
+
+        seed(sx, sy, ignored, avoidTowers);
+        for(int node = 0; node < _nbWaypoints; ++node)
+        {
+            if(_cost[node] < std::numeric_limits<float>::max())
+            {
+                pushHeap(_cost[node] + remaining(_wx[node], _wy[node]), node);
+            }
+        }
+        const uint32_t goalInside = insideMask(goal.x, goal.y) | goalBit;
+        float best = std::numeric_limits<float>::max();
+        int bestNode = -1;
+        while(!_heap.empty() && _heap.front().priority < best)
+        {
+            const HeapEntry entry = popHeap();
+            if(_closed[entry.node])
+            {
+                continue;
+            }
+            _closed[entry.node] = true;
+            const int node = entry.node;
+            const bool seesGoal = goal.siteId >= 0 ? (_seesSite[node] & goalBit) != 0
+                                                   : segmentClear(_wx[node], _wy[node], goal.x, goal.y, goalInside);
+            if(seesGoal && _cost[node] + remaining(_wx[node], _wy[node]) < best)
+            {
+                best = _cost[node] + remaining(_wx[node], _wy[node]);
+                bestNode = node;
+            }
+            relax(node, avoidTowers, &goal);
+        }
+        if(bestNode < 0)
+        {
+            return remaining(sx, sy);
+        }
+        if(firstStep)
+        {
+            int node = bestNode;
+            while(_parent[node] >= 0)
+            {
+                node = _parent[node];
+            }
+            *firstStep = Position(static_cast<int>(std::lround(_wx[node])), static_cast<int>(std::lround(_wy[node])));
+        }
+        return best;
+    }
+
+    inline void relax(int node, bool avoidTowers, const Goal* goal)
+    {
+        for(int edge = _adjacencyStart[node]; edge < _adjacencyStart[node + 1]; ++edge)
+        {
+            const int next = _adjacentTo[edge];
+            const float cost = _cost[node] + _adjacentLength[edge] + nodePenalty(next, avoidTowers);
+            if(!_closed[next] && cost < _cost[next])
+            {
+                _cost[next] = cost;
+                _parent[next] = node;
+                const float heuristic = goal ? std::max(0.0f, length(_wx[next], _wy[next], goal->x, goal->y) - goal->radius) : 0.0f;
+                pushHeap(cost + heuristic, next);
+            }
+        }
+    }
+
+    inline void pushHeap(float priority, int node)
+    {
+        _heap.push_back(HeapEntry{priority, node});
+        std::push_heap(_heap.begin(), _heap.end());
+    }
+
+    inline HeapEntry popHeap()
+    {
+        std::pop_heap(_heap.begin(), _heap.end());
+        const HeapEntry retVal = _heap.back();
+        _heap.pop_back();
+        return retVal;
+    }
+
+    int _numSites;
+    float _cx[MAX_SITES];
+    float _cy[MAX_SITES];
+    float _obstacle[MAX_SITES];  // closest the queen's centre gets to the site's centre
+
+    int _nbWaypoints;
+    float _wx[maxWaypoints];
+    float _wy[maxWaypoints];
+    uint32_t _seesSite[maxWaypoints];  // sites whose centre is in sight, ignoring the site's own circle
+    std::vector<int> _adjacencyStart;
+    std::vector<uint16_t> _adjacentTo;
+    std::vector<float> _adjacentLength;
+    float _siteRoute[MAX_SITES][MAX_SITES];
+
+    int _nbDangerZones;
+    float _dangerX[MAX_SITES];
+    float _dangerY[MAX_SITES];
+    float _dangerRadius[MAX_SITES];
+
+    float _cost[maxWaypoints];
+    int16_t _parent[maxWaypoints];
+    bool _closed[maxWaypoints];
+    std::vector<HeapEntry> _heap;
+};
+
+
+// Site geometry derived once in readInit - sites never move or change size during a game.
+struct SiteDistanceTable
+{
+    SiteDistanceTable() : numSites(0) {}
+
+    void build(const GameState& state)
+    {
+        numSites = state.numSites;
+        for(int from = 0; from < numSites; ++from)
+        {
+            const Position fromPos = state.sitePosition(from);
+            const int fromRadius = state.sites.radius[from];
+            for(int to = 0; to < numSites; ++to)
+            {
+                const int dist = from == to ? 0 : distanceBetween(fromPos, fromRadius, state.sitePosition(to), state.sites.radius[to]);
+                distance[from][to] = dist;
+                // the queen stands next to the first site and only has to reach contact range of the second
+                const int walk = std::max(0, dist - 2 * QUEEN_RADIUS - CONTACT_RANGE);
+                travelTurns[from][to] = from == to ? 0 : (walk + QUEEN_SPEED - 1) / QUEEN_SPEED;
+            }
+
+            int nbOthers = 0;
+            for(int to = 0; to < numSites; ++to)
+            {
+                if(to != from)
+                {
+                    nearest[from][nbOthers++] = static_cast<uint8_t>(to);
+                }
+            }
+            std::sort(nearest[from], nearest[from] + nbOthers, [&](uint8_t a, uint8_t b) -> bool
+            {
+                return distance[from][a] < distance[from][b];
+            });
+
+            const int edgeX = std::min(fromPos.x, WORLD_WIDTH - fromPos.x);
+            const int edgeY = std::min(fromPos.y, WORLD_HEIGHT - fromPos.y);
+            edgeDistance[from] = std::max(0, std::min(edgeX, edgeY) - fromRadius);
+        }
+    }
+
+    // Replaces straight lines by the queen's walk around the other sites for travel turns and the nearest ordering.
+    void useRoutes(PathFinder& paths)
+    {
+        for(int from = 0; from < numSites; ++from)
+        {
+            for(int to = 0; to < numSites; ++to)
+            {
+                if(from != to)
+                {
+                    const int walk = std::max(0, static_cast<int>(paths.siteRouteLength(from, to)) - CONTACT_RANGE);
+                    travelTurns[from][to] = (walk + QUEEN_SPEED - 1) / QUEEN_SPEED;
+                }
+            }
+            std::stable_sort(nearest[from], nearest[from] + numSites - 1, [&](uint8_t a, uint8_t b) -> bool
+            {
+                return paths.siteRouteLength(from, a) < paths.siteRouteLength(from, b);
+            });
+        }
+    }
+
+    // Turns the queen needs to walk to a site from an arbitrary point.
+    static inline int travelTurnsFrom(const Position& pos, const GameState& state, int siteId)
+    {
+        const int dist = distanceBetween(pos, QUEEN_RADIUS, state.sitePosition(siteId), state.sites.radius[siteId]);
+        const int walk = std::max(0, dist - CONTACT_RANGE);
+        return (walk + QUEEN_SPEED - 1) / QUEEN_SPEED;
+    }
+
+    int numSites;
+    int distance[MAX_SITES][MAX_SITES];     // edge to edge, as distanceBetween
+    int travelTurns[MAX_SITES][MAX_SITES];  // queen turns from touching one site to touching the other
+    uint8_t nearest[MAX_SITES][MAX_SITES - 1];  // the other sites, closest first
+    int edgeDistance[MAX_SITES];            // from the site's rim to the closest map border
+};
+
+
+// Zobrist keys over a coarse view of a state: the structure and level on every site, the queens' cells,
+// gold in buckets and the number of creeps of each kind. Lookahead states that agree on all of it share a key.
+class ZobristKeys
+{
+public:
+    static constexpr int nbStructures = 11;  // empty, or one of 5 types for either owner
+    static constexpr int nbLevels = 8;
+    static constexpr int cellSize = 100;
+    static constexpr int nbCellsX = (WORLD_WIDTH + cellSize - 1) / cellSize;
+    static constexpr int nbCells = nbCellsX * ((WORLD_HEIGHT + cellSize - 1) / cellSize);
+    static constexpr int goldBucket = 50;
+    static constexpr int nbGoldBuckets = 16;
+    static constexpr int nbCreepCounts = 16;
+
+    static const ZobristKeys& instance()
+    {
+        static const ZobristKeys keys;
+        return keys;
+    }
+
+    uint64_t hash(const GameState& state) const
+    {
+        uint64_t retVal = 0;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            retVal ^= _site[siteId][structure(state.sites, siteId)][level(state.sites, siteId)];
+        }
+        Summary summary;
+        summarize(state, summary);
+        return retVal ^ summaryKey(summary);
+    }
+
+private:
+    struct Summary
+    {
+        int queenCell[2];
+        int goldBucket[2];
+        int creeps[2][3];
+    };
+
+    ZobristKeys()
+    {
+        // splitmix64 - any fixed sequence of well mixed numbers will do
+        uint64_t seed = 0x9e3779b97f4a7c15ull;
+        auto next = [&seed]() -> uint64_t
+        {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        };
+        uint64_t* tables[] = {&_site[0][0][0], &_queenCell[0][0], &_gold[0][0], &_creeps[0][0][0]};
+        const size_t sizes[] = {sizeof(_site), sizeof(_queenCell), sizeof(_gold), sizeof(_creeps)};
+        for(int table = 0; table < 4; ++table)
+        {
+            for(size_t cnt = 0; cnt < sizes[table] / sizeof(uint64_t); ++cnt)
+            {
+                tables[table][cnt] = next();
+            }
+        }
+    }
+
+    static inline int structure(const GameState::Sites& sites, int siteId)
+    {
+        if(sites.type[siteId] == StructureType::EMPTY_SITE)
+        {
+            return 0;
+        }
+        return static_cast<int>(sites.type[siteId]) + (sites.owner[siteId] == 0 ? 0 : 5);
+    }
+
+    // Mine size, tower hp in steps of 100, barracks busy training or not.
+    static inline int level(const GameState::Sites& sites, int siteId)
+    {
+        const int param1 = sites.param1[siteId];
+        switch (sites.type[siteId])
+        {
+            case StructureType::MINE:
+                return std::min(std::max(param1, 0), nbLevels - 1);
+            case StructureType::TOWER:
+                return std::min(std::max(param1 / 100, 0), nbLevels - 1);
+            case StructureType::BARRACKS_KNIGHT:
+            case StructureType::BARRACKS_ARCHER:
+            case StructureType::BARRACKS_GIANT:
+                return param1 > 0 ? 1 : 0;
+            case StructureType::EMPTY_SITE:
+                break;
+        }
+        return 0;
+    }
+
+    static void summarize(const GameState& state, Summary& summary)
+    {
+        std::memset(&summary, 0, sizeof(summary));
+        summary.queenCell[0] = nbCells;
+        summary.queenCell[1] = nbCells;
+        const GameState::Units& units = state.units;
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            const int owner = units.owner[unitIdx];
+            if(units.type[unitIdx] == UnitType::QUEEN)
+            {
+                const int cellX = std::min(std::max(units.x[unitIdx] / cellSize, 0), nbCellsX - 1);
+                const int cellY = std::min(std::max(units.y[unitIdx] / cellSize, 0), nbCells / nbCellsX - 1);
+                summary.queenCell[owner] = cellY * nbCellsX + cellX;
+            }
+            else
+            {
+                ++summary.creeps[owner][static_cast<int>(units.type[unitIdx])];
+            }
+        }
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            summary.goldBucket[owner] = std::min(std::max(state.gold[owner] / goldBucket, 0), nbGoldBuckets - 1);
+        }
+    }
+
+    inline uint64_t summaryKey(const Summary& summary) const
+    {
+        uint64_t retVal = 0;
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            retVal ^= _queenCell[owner][summary.queenCell[owner]] ^ _gold[owner][summary.goldBucket[owner]];
+            for(int uType = 0; uType < 3; ++uType)
+            {
+                retVal ^= _creeps[owner][uType][std::min(summary.creeps[owner][uType], nbCreepCounts - 1)];
+            }
+        }
+        return retVal;
+    }
+
+    uint64_t _site[MAX_SITES][nbStructures][nbLevels];
+    uint64_t _queenCell[2][nbCells + 1];  // the last cell stands for a dead queen
+    uint64_t _gold[2][nbGoldBuckets];
+    uint64_t _creeps[2][3][nbCreepCounts];
+};
+
+
+// Fixed-size table of the states a search has scored, one cache line per bucket.
+// Entries of older searches are only kept for their best move - the first one tried from that state next time.
+class TranspositionTable
+{
+public:
+    static constexpr int nbBuckets = 1 << 14;
+    static constexpr int entriesPerBucket = 4;
+
+    // The low bits of a key pick the bucket, the high half tells the entries apart.
+    struct Entry
+    {
+        uint32_t check;
+        float score;      // the state's own rollout score
+        float bestScore;  // best child seen, the one bestMove leads to
+        uint16_t bestMove;
+        uint8_t generation;
+        uint8_t elapsedTurns;
+
+        // stored states have no score until their rollout is done
+        inline bool evaluated() const { return score != -std::numeric_limits<float>::infinity(); }
+    };
+
+    TranspositionTable() : _buckets(nbBuckets), _generation(0) {}
+
+    // Starts a new search: entries from before only count for their best move.
+    inline void newSearch() { ++_generation; }
+    inline uint8_t generation() const { return _generation; }
+
+    inline Entry* probe(uint64_t key)
+    {
+        Bucket& bucket = _buckets[key & (nbBuckets - 1)];
+        const uint32_t check = static_cast<uint32_t>(key >> 32);
+        for(Entry& entry : bucket.entries)
+        {
+            if(entry.check == check)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    // The entry of a state reached by this search, replacing the oldest and then the latest-reached one in the bucket.
+    Entry& store(uint64_t key, int elapsedTurns)
+    {
+        Bucket& bucket = _buckets[key & (nbBuckets - 1)];
+        const uint32_t check = static_cast<uint32_t>(key >> 32);
+        Entry* victim = &bucket.entries[0];
+        for(Entry& entry : bucket.entries)
+        {
+            if(entry.check == check)
+            {
+                victim = &entry;
+                break;
+            }
+            if(replaceBefore(entry, *victim))
+            {
+                victim = &entry;
+            }
+        }
+        if(victim->check != check)
+        {
+            victim->check = check;
+            victim->bestMove = 0;
+            victim->bestScore = -std::numeric_limits<float>::infinity();
+        }
+        else if(victim->generation != _generation)
+        {
+            // the old best move stays as a hint, its score is not comparable with this search's
+            victim->bestScore = -std::numeric_limits<float>::infinity();
+        }
+        victim->score = -std::numeric_limits<float>::infinity();
+        victim->generation = _generation;
+        victim->elapsedTurns = static_cast<uint8_t>(std::min(elapsedTurns, 255));
+        return *victim;
+    }
+
+    // Search candidates are BUILD orders; other actions are not kept as best moves.
+    static inline uint16_t packMove(const QueenAction& action)
+    {
+        return action.type == QueenActionType::BUILD ? static_cast<uint16_t>(1 + (action.siteId << 3 | static_cast<int>(action.sType))) : 0;
+    }
+
+    static inline QueenAction unpackMove(uint16_t move)
+    {
+        return QueenAction::build((move - 1) >> 3, static_cast<StructureType>((move - 1) & 7));
+    }
+
+private:
+    struct alignas(64) Bucket
+    {
+        Bucket() { std::memset(entries, 0, sizeof(entries)); }
+
+        Entry entries[entriesPerBucket];
+    };
+    static_assert(sizeof(Bucket) == 64, "a bucket fills one cache line");
+
+    inline bool replaceBefore(const Entry& a, const Entry& b) const
+    {
+        const bool aOld = a.generation != _generation;
+        const bool bOld = b.generation != _generation;
+        if(aOld != bOld)
+        {
+            return aOld;
+        }
+        return a.elapsedTurns > b.elapsedTurns;
+    }
+
+    std::vector<Bucket> _buckets;
+    uint8_t _generation;
+};
+
+
+// Anytime beam search over short sequences of queen macro actions.
+// A macro action is a BUILD (walk to the site and build) or a MOVE, simulated until it completes.
+// Every leaf is padded with WAIT to the same horizon so scores from different depths compare fairly.
+class BeamSearch
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int beamWidth = 6;
+    static constexpr int maxDepth = 4;
+    static constexpr int horizonTurns = 24;
+    static constexpr int maxMacroTurns = 12;
+    static constexpr int nbCandidateSites = 6;
+    static constexpr int maxCandidates = 32;
+
+    BeamSearch() : _siteTable(nullptr), _stopFlag(nullptr), _maxEvaluations(-1), _nbPending(0), _nbCredits(0), _keys(ZobristKeys::instance()), _nbTranspositions(0)
+    {
+        _beam.reserve(beamWidth);
+        _children.reserve(beamWidth * maxCandidates);
+        // the horizon rollouts: both queens hold still, every barracks trains
+        for(int lane = 0; lane < BatchSimulator::lanes; ++lane)
+        {
+            _rolloutCommands[lane][0].trainMask = ~0u;
+            _rolloutCommands[lane][1].trainMask = ~0u;
+        }
+    }
+
+    // Returns the first action of the best sequence found before the deadline.
+    // The fallback action is scored first so there's always an answer at least as good as it.
+    // A pondered action - the best move found for a predicted version of this state - joins the first ply.
+    QueenAction run(const GameState& root, const QueenAction& fallback, Clock::time_point deadline,
+                    const QueenAction* pondered = nullptr)
+    {
+        _deadline = deadline;
+        _nbEvaluations = 0;
+        _completedDepth = 0;
+        _best = fallback;
+        _bestScore = -1e30;
+        _rollouts.reset(root);
+        _nbPending = 0;
+        _nbCredits = 0;
+        _nbTranspositions = 0;
+        _table.newSearch();
+
+        _beam.clear();
+        _beam.emplace_back();
+        Node& rootNode = _beam.back();
+        rootNode.state = root;
+        rootNode.firstAction = fallback;
+        rootNode.key = _keys.hash(root);
+        _table.store(rootNode.key, 0);
+
+        for(int depth = 0; depth < maxDepth; ++depth)
+        {
+            _children.clear();
+            for(const Node& node : _beam)
+            {
+                QueenAction candidates[maxCandidates];
+                int nbCandidates = generateCandidates(node.state, candidates);
+                if(depth == 0)
+                {
+                    candidates[nbCandidates++] = fallback;
+                    if(pondered && *pondered != fallback)
+                    {
+                        candidates[nbCandidates++] = *pondered;
+                    }
+                }
+                tryBestMoveFirst(node.key, candidates, nbCandidates);
+                for(int cnt = 0; cnt < nbCandidates; ++cnt)
+                {
+                    if(evaluationLimitReached())
+                    {
+                        evaluatePending();
+                        return _best;
+                    }
+                    if(timeIsUp())
+                    {
+                        return _best;
+                    }
+                    _children.emplace_back(node);
+                    Node& child = _children.back();
+                    if(depth == 0)
+                    {
+                        child.firstAction = candidates[cnt];
+                    }
+                    child.lastAction = candidates[cnt];
+                    child.parentKey = node.key;
+                    child.elapsedTurns += simulateMacro(child.state, candidates[cnt], maxMacroTurns);
+                    // hashed from scratch: the macro's turns of decay, depletion and fighting can change any site
+                    child.key = _keys.hash(child.state);
+                    // a state this search already reached by another route, as early or earlier, is not scored again -
+                    // the twin's score credits this move, once its rollout is done if it is still waiting for one
+                    const TranspositionTable::Entry* seen = _table.probe(child.key);
+                    if(seen && seen->generation == _table.generation() && seen->elapsedTurns <= child.elapsedTurns)
+                    {
+                        if(seen->evaluated())
+                        {
+                            recordBestMove(node.key, candidates[cnt], seen->score);
+                        }
+                        else
+                        {
+                            _credits[_nbCredits++] = Credit{node.key, child.key, candidates[cnt]};
+                        }
+                        _children.pop_back();
+                        ++_nbTranspositions;
+                        continue;
+                    }
+                    _table.store(child.key, child.elapsedTurns);
+                    _pending[_nbPending++] = static_cast<int>(_children.size()) - 1;
+                    if(_nbPending == BatchSimulator::lanes)
+                    {
+                        evaluatePending();
+                    }
+                }
+            }
+            evaluatePending();
+            if(_children.empty())
+            {
+                break;
+            }
+            const size_t kept = std::min(_children.size(), static_cast<size_t>(beamWidth));
+            std::partial_sort(_children.begin(), _children.begin() + kept, _children.end(),
+                              [](const Node& a, const Node& b) -> bool
+            {
+                return a.score > b.score;
+            });
+            _beam.assign(_children.begin(), _children.begin() + kept);
+            _completedDepth = depth + 1;
+        }
+        return _best;
+    }
+
+    inline void setSiteTable(const SiteDistanceTable* siteTable) { _siteTable = siteTable; }
+    inline void setEvaluationLimit(int maxEvaluations) { _maxEvaluations = maxEvaluations; }
+    // Lets another thread interrupt a run - polled before every evaluation like the deadline.
+    inline void setStopFlag(const std::atomic<bool>* stopFlag) { _stopFlag = stopFlag; }
+
+    inline int getNbEvaluations() const { return _nbEvaluations; }
+    inline int getCompletedDepth() const { return _completedDepth; }
+    inline int getNbTranspositions() const { return _nbTranspositions; }
+    inline double getBestScore() const { return _bestScore; }
+
+    // Static evaluation from owner 0's point of view.
+    static double evaluate(const GameState& state)
+    {
+        // the enemy queen only WAITs in our rollouts, so damage dealt to her is trusted less than damage taken
+        constexpr double ourQueenHpWeight = 40.0;
+        constexpr double theirQueenHpWeight = 8.0;
+        constexpr double deadQueenPenalty = 1e6;
+        constexpr double goldWeight = 1.0;
+        constexpr double incomeWeight = 60.0;
+        constexpr double towerHpWeight = 0.25;
+        constexpr double structureWeight = 25.0;
+        constexpr double barracksWeight = 20.0;
+        constexpr double creepHpWeight = 0.3;
+
+        int queens[2];
+        Simulator::findQueens(state, queens);
+        const int ourHp = queens[0] >= 0 ? state.units.hp[queens[0]] : 0;
+        const int theirHp = queens[1] >= 0 ? state.units.hp[queens[1]] : 0;
+
+        double score = ourQueenHpWeight * ourHp - theirQueenHpWeight * theirHp + goldWeight * state.gold[0];
+        if(ourHp <= 0)
+        {
+            score -= deadQueenPenalty;
+        }
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            const int owner = state.sites.owner[siteId];
+            if(owner < 0)
+            {
+                continue;
+            }
+            double value = structureWeight;
+            switch (state.sites.type[siteId])
+            {
+                case StructureType::MINE:
+                    value += incomeWeight * state.sites.param1[siteId];
+                    break;
+                case StructureType::TOWER:
+                    value += towerHpWeight * state.sites.param1[siteId];
+                    break;
+                case StructureType::BARRACKS_KNIGHT:
+                case StructureType::BARRACKS_ARCHER:
+                case StructureType::BARRACKS_GIANT:
+                    value += barracksWeight;
+                    break;
+                case StructureType::EMPTY_SITE:
+                    break;
+            }
+            score += owner == 0 ? value : -value;
+        }
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            if(state.units.type[unitIdx] != UnitType::QUEEN)
+            {
+                const double value = creepHpWeight * state.units.hp[unitIdx];
+                score += state.units.owner[unitIdx] == 0 ? value : -value;
+            }
+        }
+        return score;
+    }
+
+    // Runs one macro action for owner 0 and returns the number of simulated turns.
+    static int simulateMacro(GameState& state, const QueenAction& action, int maxTurns)
+    {
+        PlayerCommands commands[2];
+        commands[0].queen = action;
+        commands[0].trainMask = ~0u;
+        commands[1].trainMask = ~0u;
+
+        const StructureType typeBefore = action.type == QueenActionType::BUILD ? state.sites.type[action.siteId] : StructureType::EMPTY_SITE;
+        const int ownerBefore = action.type == QueenActionType::BUILD ? state.sites.owner[action.siteId] : -1;
+        const int param1Before = action.type == QueenActionType::BUILD ? state.sites.param1[action.siteId] : 0;
+
+        int turns = 0;
+        while(turns < maxTurns && !Simulator::isGameOver(state))
+        {
+            Simulator::step(state, commands);
+            ++turns;
+            if(action.type == QueenActionType::WAIT)
+            {
+                continue;
+            }
+            if(action.type == QueenActionType::BUILD)
+            {
+                const int siteId = action.siteId;
+                if(state.sites.owner[siteId] != ownerBefore || state.sites.type[siteId] != typeBefore || state.sites.param1[siteId] > param1Before)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                int queens[2];
+                Simulator::findQueens(state, queens);
+                if(queens[0] < 0 || (state.units.x[queens[0]] == action.x && state.units.y[queens[0]] == action.y))
+                {
+                    break;
+                }
+            }
+        }
+        return turns;
+    }
+
+private:
+    struct Node
+    {
+        Node() : key(0), parentKey(0), elapsedTurns(0), score(0.0) {}
+
+        GameState state;
+        QueenAction firstAction;
+        QueenAction lastAction;  // the macro that led here from the parent
+        uint64_t key;
+        uint64_t parentKey;
+        int elapsedTurns;
+        double score;
+    };
+
+    // A transposition whose twin was still waiting for its rollout when it was skipped.
+    struct Credit
+    {
+        uint64_t parentKey;
+        uint64_t twinKey;
+        QueenAction action;
+    };
+
+    inline void recordBestMove(uint64_t key, const QueenAction& action, double score)
+    {
+        TranspositionTable::Entry* entry = _table.probe(key);
+        if(entry && score > entry->bestScore)
+        {
+            entry->bestScore = static_cast<float>(score);
+            entry->bestMove = TranspositionTable::packMove(action);
+        }
+    }
+
+    // The best move stored for the state - by this search or an earlier one - is tried first.
+    inline void tryBestMoveFirst(uint64_t key, QueenAction* candidates, int nbCandidates)
+    {
+        const TranspositionTable::Entry* entry = _table.probe(key);
+        if(!entry || entry->bestMove == 0)
+        {
+            return;
+        }
+        const QueenAction best = TranspositionTable::unpackMove(entry->bestMove);
+        for(int cnt = 0; cnt < nbCandidates; ++cnt)
+        {
+            if(candidates[cnt] == best)
+            {
+                std::rotate(candidates, candidates + cnt, candidates + cnt + 1);
+                return;
+            }
+        }
+    }
+
+    // Children waiting for their rollout count as evaluated - they will be before the search returns.
+    inline bool evaluationLimitReached() const
+    {
+        return _maxEvaluations >= 0 && _nbEvaluations + _nbPending >= _maxEvaluations;
+    }
+
+    // A run stopped by the clock or by another thread drops the children still waiting for their rollout.
+    inline bool timeIsUp() const
+    {
+        return (_stopFlag && _stopFlag->load(std::memory_order_relaxed)) || Clock::now() >= _deadline;
+    }
+
+    // Plays the pending children out to the horizon together, our queen waiting, and scores them in the order they were queued.
+    void evaluatePending()
+    {
+        if(_nbPending == 0)
+        {
+            return;
+        }
+        int remainingTurns[BatchSimulator::lanes];
+        for(int lane = 0; lane < _nbPending; ++lane)
+        {
+            const Node& child = _children[_pending[lane]];
+            _rollouts.load(lane, child.state);
+            remainingTurns[lane] = horizonTurns - child.elapsedTurns;
+            if(remainingTurns[lane] <= 0)
+            {
+                _rollouts.deactivate(lane);
+            }
+        }
+        while(_rollouts.activeMask() != 0)
+        {
+            const uint32_t stepped = _rollouts.activeMask();
+            _rollouts.step(_rolloutCommands);
+            for(uint32_t mask = stepped; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                if(--remainingTurns[lane] == 0)
+                {
+                    _rollouts.deactivate(lane);
+                }
+            }
+        }
+        for(int lane = 0; lane < _nbPending; ++lane)
+        {
+            Node& child = _children[_pending[lane]];
+            _rollouts.store(lane, _scratch);
+            ++_nbEvaluations;
+            child.score = evaluate(_scratch);
+            if(TranspositionTable::Entry* entry = _table.probe(child.key))
+            {
+                entry->score = static_cast<float>(child.score);
+            }
+            recordBestMove(child.parentKey, child.lastAction, child.score);
+            if(child.score > _bestScore)
+            {
+                _bestScore = child.score;
+                _best = child.firstAction;
+            }
+        }
+        _nbPending = 0;
+        for(int cnt = 0; cnt < _nbCredits; ++cnt)
+        {
+            const Credit& credit = _credits[cnt];
+            const TranspositionTable::Entry* twin = _table.probe(credit.twinKey);
+            if(twin && twin->evaluated())
+            {
+                recordBestMove(credit.parentKey, credit.action, twin->score);
+            }
+        }
+        _nbCredits = 0;
+    }
+
+    // Build orders on the sites nearest to our queen plus upgrades of what we already own.
+    // When the queen stands at a site the static nearest-site ordering replaces the distance sort.
+    int generateCandidates(const GameState& state, QueenAction* candidates) const
+    {
+        int queens[2];
+        Simulator::findQueens(state, queens);
+        if(queens[0] < 0)
+        {
+            return 0;
+        }
+
+        int order[MAX_SITES];
+        int nbOrdered = 0;
+        const int touchedSite = _siteTable ? Simulator::findTouchedSite(state, queens[0]) : -1;
+        if(touchedSite >= 0)
+        {
+            order[nbOrdered++] = touchedSite;
+            for(int cnt = 0; cnt < state.numSites - 1; ++cnt)
+            {
+                order[nbOrdered++] = _siteTable->nearest[touchedSite][cnt];
+            }
+        }
+        else
+        {
+            const int qx = state.units.x[queens[0]];
+            const int qy = state.units.y[queens[0]];
+            int distances[MAX_SITES];
+            for(int siteId = 0; siteId < state.numSites; ++siteId)
+            {
+                const int dx = state.sites.x[siteId] - qx;
+                const int dy = state.sites.y[siteId] - qy;
+                distances[siteId] = dx*dx + dy*dy;
+                order[nbOrdered++] = siteId;
+            }
+            std::sort(order, order + nbOrdered, [&](int a, int b) -> bool
+            {
+                return distances[a] < distances[b];
+            });
+        }
+
+        int siteIds[MAX_SITES];
+        int nbNearest = 0;
+        for(int cnt = 0; cnt < nbOrdered && nbNearest < nbCandidateSites; ++cnt)
+        {
+            const int siteId = order[cnt];
+            const int owner = state.sites.owner[siteId];
+            const StructureType sType = state.sites.type[siteId];
+            const bool buildable = owner < 0
+                    || (owner == 0 && sType == StructureType::MINE && state.sites.param1[siteId] < state.sites.maxMineSize[siteId])
+                    || (owner == 0 && sType == StructureType::TOWER && state.sites.param1[siteId] < TOWER_HP_MAXIMUM - TOWER_HP_INCREMENT);
+            if(buildable)
+            {
+                siteIds[nbNearest++] = siteId;
+            }
+        }
+
+        int nbCandidates = 0;
+        for(int cnt = 0; cnt < nbNearest; ++cnt)
+        {
+            const int siteId = siteIds[cnt];
+            const StructureType sType = state.sites.type[siteId];
+            if(state.sites.owner[siteId] == 0)
+            {
+                candidates[nbCandidates++] = QueenAction::build(siteId, sType);
+                continue;
+            }
+            if(state.sites.gold[siteId] != 0)
+            {
+                candidates[nbCandidates++] = QueenAction::build(siteId, StructureType::MINE);
+            }
+            candidates[nbCandidates++] = QueenAction::build(siteId, StructureType::TOWER);
+            candidates[nbCandidates++] = QueenAction::build(siteId, StructureType::BARRACKS_KNIGHT);
+        }
+        return nbCandidates;
+    }
+
+    const SiteDistanceTable* _siteTable;
+    const std::atomic<bool>* _stopFlag;
+    int _maxEvaluations;
+    std::vector<Node> _beam;
+    std::vector<Node> _children;
+    GameState _scratch;
+    BatchSimulator _rollouts;
+    PlayerCommands _rolloutCommands[BatchSimulator::lanes][2];
+    int _pending[BatchSimulator::lanes]; // _children indices waiting for their rollout
+    int _nbPending;
+    // every child of a ply at most, all pending twins being scored when the ply ends
+    Credit _credits[beamWidth * maxCandidates];
+    int _nbCredits;
+    const ZobristKeys& _keys;
+    TranspositionTable _table;
+    int _nbTranspositions;
+    Clock::time_point _deadline;
+    QueenAction _best;
+    double _bestScore;
+    int _nbEvaluations;
+    int _completedDepth;
+};
+
+
+// Lock-free queue between exactly one producer thread and one consumer thread.
+// Each index is only ever written by one side; the release store on it publishes the slot contents.
+template<typename T, int Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue() : _head(0), _tail(0) {}
+
+    // Producer side. Returns false when the queue is full.
+    bool push(const T& item)
+    {
+        const uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail - _head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        _items[tail & (Capacity - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when the queue is empty.
+    bool pop(T& item)
+    {
+        const uint32_t head = _head.load(std::memory_order_relaxed);
+        if(head == _tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = _items[head & (Capacity - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<uint32_t> _head;
+    alignas(64) std::atomic<uint32_t> _tail;
+    T _items[Capacity];
+};
+
+
+// Runs the beam search on the predicted next turn while the main thread sits blocked on stdin.
+// The main thread is the only producer of jobs and the only consumer of results - the worker is the opposite end of both.
+// At most one job is in flight: collect() always waits for the answer to the last submit() before the next one.
+class Ponderer
+{
+public:
+    struct Job
+    {
+        GameState predicted;
+        QueenAction fallback;
+        int turn;
+    };
+
+    struct Result
+    {
+        QueenAction best;
+        int turn;
+        int nbEvaluations;
+        int completedDepth;
+    };
+
+    Ponderer() : _stop(false), _quit(false), _pending(false)
+    {
+        _search.setStopFlag(&_stop);
+    }
+
+    ~Ponderer()
+    {
+        shutdown();
+    }
+
+    void start(const SiteDistanceTable* siteTable)
+    {
+        if(_worker.joinable())
+        {
+            return;
+        }
+        _search.setSiteTable(siteTable);
+        _worker = std::thread(&Ponderer::work, this);
+    }
+
+    void shutdown()
+    {
+        if(!_worker.joinable())
+        {
+            return;
+        }
+        _stop.store(true, std::memory_order_relaxed);
+        _quit.store(true, std::memory_order_release);
+        _worker.join();
+    }
+
+    inline bool isRunning() const { return _worker.joinable(); }
+
+    void submit(const Job& job)
+    {
+        _stop.store(false, std::memory_order_relaxed);
+        _pending = _jobs.push(job);
+    }
+
+    // Called as soon as the next input arrives, so the worker stops competing with the parser.
+    inline void interrupt()
+    {
+        _stop.store(true, std::memory_order_relaxed);
+    }
+
+    // Waits for the worker's answer to the last job - at most one evaluation once interrupted.
+    // Returns false when there was no job or it was stopped before evaluating anything.
+    bool collect(Result& result)
+    {
+        if(!_pending)
+        {
+            return false;
+        }
+        interrupt();
+        while(!_results.pop(result))
+        {
+            std::this_thread::yield();
+        }
+        _pending = false;
+        return result.nbEvaluations > 0;
+    }
+
+private:
+    static constexpr std::chrono::microseconds idleSleep{200};
+
+    void work()
+    {
+        while(!_quit.load(std::memory_order_acquire))
+        {
+            if(!_jobs.pop(_job))
+            {
+                std::this_thread::sleep_for(idleSleep);
+                continue;
+            }
+            Result result;
+            // no deadline - the search runs to full depth unless the next input interrupts it
+            result.best = _search.run(_job.predicted, _job.fallback, BeamSearch::Clock::time_point::max());
+            result.turn = _job.turn;
+            result.nbEvaluations = _search.getNbEvaluations();
+            result.completedDepth = _search.getCompletedDepth();
+            _results.push(result);
+        }
+    }
+
+    BeamSearch _search;
+    Job _job;
+    SpscQueue<Job, 2> _jobs;
+    SpscQueue<Result, 2> _results;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _quit;
+    bool _pending;
+    std::thread _worker;
+};
+
+
+// Binary match capture. A file holds a CaptureFileHeader and numSites CaptureSite entries,
+// followed by one record per turn: CaptureTurnHeader, numSites CaptureSiteState, numUnits CaptureUnit.
+// recordSize covers the whole turn record so readers can skip over it.
+#pragma pack(push, 1)
+struct CaptureFileHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t numSites;
+    uint8_t reserved;
+};
+
+struct CaptureSite
+{
+    int16_t x;
+    int16_t y;
+    int16_t radius;
+};
+
+struct CaptureCommands
+{
+    uint8_t queenAction;
+    int16_t x;
+    int16_t y;
+    int8_t siteId;
+    uint8_t sType;
+    uint32_t trainMask;
+};
+
+struct CaptureTurnHeader
+{
+    uint16_t recordSize;
+    uint16_t turn;
+    int32_t gold;
+    int8_t touchedSite;
+    uint8_t numUnits;
+    CaptureCommands commands;
+    uint32_t phaseMicros[TurnDeadline::nbPhases];
+};
+
+struct CaptureSiteState
+{
+    int16_t gold;
+    int8_t maxMineSize;
+    int8_t type;
+    int8_t owner;
+    int16_t param1;
+    int16_t param2;
+};
+
+struct CaptureUnit
+{
+    int16_t x;
+    int16_t y;
+    int8_t owner;
+    int8_t type;
+    int16_t hp;
+};
+#pragma pack(pop)
+
+constexpr char CAPTURE_MAGIC[4] = {'C', 'R', 'L', 'G'};
+constexpr uint16_t CAPTURE_VERSION = 1;
+constexpr size_t CAPTURE_MAX_RECORD = sizeof(CaptureTurnHeader) + MAX_SITES * sizeof(CaptureSiteState) + MAX_UNITS * sizeof(CaptureUnit);
+
+// Writes the capture of the match being played. Records are assembled in place and handed to stdio
+// in one fwrite, after the turn's commands have already been sent.
+class MatchRecorder
+{
+public:
+    MatchRecorder() : _file(nullptr) {}
+    ~MatchRecorder() { close(); }
+
+    bool open(const char* path)
+    {
+        close();
+        _file = std::fopen(path, "wb");
+        if(_file)
+        {
+            std::setvbuf(_file, nullptr, _IOFBF, 1 << 16);
+        }
+        return _file != nullptr;
+    }
+
+    inline bool isOpen() const { return _file != nullptr; }
+
+    void close()
+    {
+        if(_file)
+        {
+            std::fclose(_file);
+            _file = nullptr;
+        }
+    }
+
+    void writeInit(const GameState& state)
+    {
+        if(!_file)
+        {
+            return;
+        }
+        CaptureFileHeader header;
+        std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+        header.version = CAPTURE_VERSION;
+        header.numSites = static_cast<uint8_t>(state.numSites);
+        header.reserved = 0;
+        std::fwrite(&header, sizeof(header), 1, _file);
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            CaptureSite site;
+            site.x = static_cast<int16_t>(state.sites.x[siteId]);
+            site.y = static_cast<int16_t>(state.sites.y[siteId]);
+            site.radius = static_cast<int16_t>(state.sites.radius[siteId]);
+            std::fwrite(&site, sizeof(site), 1, _file);
+        }
+    }
+
+    void writeTurn(const GameState& state, const PlayerCommands& commands, const TurnDeadline& deadline)
+    {
+        if(!_file)
+        {
+            return;
+        }
+        CaptureTurnHeader header;
+        header.recordSize = static_cast<uint16_t>(sizeof(CaptureTurnHeader) + state.numSites * sizeof(CaptureSiteState)
+                                                  + state.numUnits * sizeof(CaptureUnit));
+        header.turn = static_cast<uint16_t>(state.turn);
+        header.gold = state.gold[0];
+        header.touchedSite = static_cast<int8_t>(state.touchedSite[0]);
+        header.numUnits = static_cast<uint8_t>(state.numUnits);
+        header.commands.queenAction = static_cast<uint8_t>(commands.queen.type);
+        header.commands.x = static_cast<int16_t>(commands.queen.x);
+        header.commands.y = static_cast<int16_t>(commands.queen.y);
+        header.commands.siteId = static_cast<int8_t>(commands.queen.siteId);
+        header.commands.sType = static_cast<uint8_t>(commands.queen.sType);
+        header.commands.trainMask = commands.trainMask;
+        for(int phase = 0; phase < TurnDeadline::nbPhases; ++phase)
+        {
+            header.phaseMicros[phase] = static_cast<uint32_t>(deadline.phaseElapsed(static_cast<TurnPhase>(phase)).count());
+        }
+
+        size_t size = 0;
+        std::memcpy(_record + size, &header, sizeof(header));
+        size += sizeof(header);
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            CaptureSiteState site;
+            site.gold = static_cast<int16_t>(state.sites.gold[siteId]);
+            site.maxMineSize = static_cast<int8_t>(state.sites.maxMineSize[siteId]);
+            site.type = static_cast<int8_t>(state.sites.type[siteId]);
+            site.owner = static_cast<int8_t>(state.sites.owner[siteId]);
+            site.param1 = static_cast<int16_t>(state.sites.param1[siteId]);
+            site.param2 = static_cast<int16_t>(state.sites.param2[siteId]);
+            std::memcpy(_record + size, &site, sizeof(site));
+            size += sizeof(site);
+        }
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            CaptureUnit unit;
+            unit.x = static_cast<int16_t>(state.units.x[unitIdx]);
+            unit.y = static_cast<int16_t>(state.units.y[unitIdx]);
+            unit.owner = static_cast<int8_t>(state.units.owner[unitIdx]);
+            unit.type = static_cast<int8_t>(state.units.type[unitIdx]);
+            unit.hp = static_cast<int16_t>(state.units.hp[unitIdx]);
+            std::memcpy(_record + size, &unit, sizeof(unit));
+            size += sizeof(unit);
+        }
+        std::fwrite(_record, size, 1, _file);
+    }
+
+private:
+    FILE* _file;
+    char _record[CAPTURE_MAX_RECORD];
+};
+
+
+// Where the enemy knights and giants will be over the next turns, found by stepping the simulator with both queens
+// holding still and no new training orders - batches already in training do spawn. Owner 1 is the enemy.
+// Answers "how much damage does a queen standing at P take during turn t+k" with a scan of that turn's knights.
+class CreepForecast
+{
+public:
+    static constexpr int horizon = 8;
+
+    CreepForecast() : _nbTurns(0) {}
+
+    inline void clear() { _nbTurns = 0; }
+
+    void build(const GameState& state)
+    {
+        GameState future = state;
+        const PlayerCommands commands[2];
+        _nbTurns = 0;
+        while(_nbTurns < horizon && !Simulator::isGameOver(future))
+        {
+            Simulator::step(future, commands);
+            Turn& forecast = _turns[_nbTurns++];
+            forecast.nbKnights = 0;
+            forecast.nbGiants = 0;
+            for(int unitIdx = 0; unitIdx < future.numUnits; ++unitIdx)
+            {
+                if(future.units.owner[unitIdx] != 1)
+                {
+                    continue;
+                }
+                if(future.units.type[unitIdx] == UnitType::KNIGHT)
+                {
+                    forecast.knightX[forecast.nbKnights] = static_cast<int16_t>(future.units.x[unitIdx]);
+                    forecast.knightY[forecast.nbKnights++] = static_cast<int16_t>(future.units.y[unitIdx]);
+                }
+                else if(future.units.type[unitIdx] == UnitType::GIANT)
+                {
+                    forecast.giantX[forecast.nbGiants] = static_cast<int16_t>(future.units.x[unitIdx]);
+                    forecast.giantY[forecast.nbGiants++] = static_cast<int16_t>(future.units.y[unitIdx]);
+                }
+            }
+            for(int siteId = 0; siteId < future.numSites; ++siteId)
+            {
+                const bool ourTower = future.sites.owner[siteId] == 0 && future.sites.type[siteId] == StructureType::TOWER;
+                forecast.towerHp[siteId] = static_cast<int16_t>(ourTower ? future.sites.param1[siteId] : 0);
+            }
+        }
+    }
+
+    inline int nbTurns() const { return _nbTurns; }
+
+    // Knight damage taken during turn t+turnsAhead (from 1) by a queen standing at pos.
+    inline int queenDamageAt(const Position& pos, int turnsAhead) const
+    {
+        if(turnsAhead < 1 || turnsAhead > _nbTurns)
+        {
+            return 0;
+        }
+        const int reach = QUEEN_RADIUS + creepStats(UnitType::KNIGHT).radius + CONTACT_RANGE;
+        const Turn& forecast = _turns[turnsAhead - 1];
+        int retVal = 0;
+        for(int knight = 0; knight < forecast.nbKnights; ++knight)
+        {
+            const int dx = forecast.knightX[knight] - pos.x;
+            const int dy = forecast.knightY[knight] - pos.y;
+            retVal += dx*dx + dy*dy < reach*reach ? KNIGHT_DAMAGE : 0;
+        }
+        return retVal;
+    }
+
+    inline int queenDamageWithin(const Position& pos, int turns) const
+    {
+        int retVal = 0;
+        for(int turnsAhead = 1; turnsAhead <= std::min(turns, _nbTurns); ++turnsAhead)
+        {
+            retVal += queenDamageAt(pos, turnsAhead);
+        }
+        return retVal;
+    }
+
+    // Our tower's hp after turn t+turnsAhead, 0 once it is gone.
+    inline int towerHpAt(int siteId, int turnsAhead) const
+    {
+        return turnsAhead >= 1 && turnsAhead <= _nbTurns ? _turns[turnsAhead - 1].towerHp[siteId] : 0;
+    }
+
+    inline int nbKnightsAt(int turnsAhead) const
+    {
+        return turnsAhead >= 1 && turnsAhead <= _nbTurns ? _turns[turnsAhead - 1].nbKnights : 0;
+    }
+
+private:
+    struct Turn
+    {
+        int nbKnights;
+        int nbGiants;
+        int16_t knightX[MAX_UNITS];
+        int16_t knightY[MAX_UNITS];
+        int16_t giantX[MAX_UNITS];
+        int16_t giantY[MAX_UNITS];
+        int16_t towerHp[MAX_SITES];
+    };
+
+    Turn _turns[horizon];
+    int _nbTurns;
+};
+
+
+// The tunable part of takeAction's strategy. tools/tuner searches it by self-play and writes the best set
+// to tuned_params.h, which replaces the defaults when it sits next to this file.
+struct StrategyParams
+{
+    int nbEnemyTowersTriggerGiant;
+    int nbFriendlyTowersMax;
+    int nbArchersMax;
+    int minAvgArcherHp;
+    int queenSafeRange;
+    int towerDesiredHp;
+    int mineKnightDistance;      // no new mine with an enemy knight this close
+    int barracksKnightDistance;  // radius counting enemy knights around a barracks candidate
+    int queenHpPerStartingMine;
+    int forecastSafetyTurns;     // the queen is unsafe if knights are predicted to reach her within this many turns
+    int knightWaveLeadTurns;     // order archers when enemy knights are expected within this many turns
+};
+
+constexpr StrategyParams DEFAULT_STRATEGY_PARAMS =
+{
+    6,    // nbEnemyTowersTriggerGiant
+    5,    // nbFriendlyTowersMax
+    2,    // nbArchersMax
+    10,   // minAvgArcherHp
+    90,   // queenSafeRange
+    220,  // towerDesiredHp
+    120,  // mineKnightDistance
+    120,  // barracksKnightDistance
+    20,   // queenHpPerStartingMine
+    2,    // forecastSafetyTurns
+    10,   // knightWaveLeadTurns
+};
+
+#if __has_include("tuned_params.h")
+#include "tuned_params.h"
+#else
+constexpr StrategyParams STRATEGY_PARAMS = DEFAULT_STRATEGY_PARAMS;
+#endif
+
+constexpr int OPENING_MAX_STEPS = 8;
+
+// One opening build order found offline by tools/openings. Sites are named by their canonical index,
+// see OpeningBook::siteOrder, and every step packs that index and the structure into one byte.
+struct OpeningLine
+{
+    uint64_t layoutHash;
+    int16_t queenX;  // queen start, mirrored onto the left half
+    int16_t queenY;
+    uint8_t nbSteps;
+    uint8_t steps[OPENING_MAX_STEPS];  // canonical site << 3 | StructureType
+};
+
+// Sorted by layoutHash. tools/openings rewrites everything between the two markers.
+// BEGIN OPENING BOOK
+// 20 lines, each scoring better than the plain bot on its map.
+constexpr OpeningLine OPENING_BOOK[] =
+{
+    {0x122b87d22d1ed9dfull, 408, 929, 4, {0x09, 0x15, 0x2d, 0x39}},  // 1.016 vs 0.500
+    {0x17ebc4045e323653ull, 339, 910, 4, {0x21, 0x4d, 0x0d, 0x15}},  // 1.015 vs 0.500
+    {0x204c6d99a89419e5ull, 100, 363, 2, {0x39, 0x22}},  // 1.018 vs 0.500
+    {0x2b6f67ec0957ceb1ull, 423, 493, 2, {0x41, 0x24}},  // 1.016 vs 0.500
+    {0x2bb913966e04709full, 109, 553, 5, {0x31, 0x3d, 0x25, 0x15, 0x02}},  // 1.017 vs 0.500
+    {0x2e8aacb2a59ae475ull, 76, 418, 2, {0x39, 0x0c}},  // 1.012 vs 0.500
+    {0x4625fe4ae47ebc93ull, 90, 247, 2, {0x39, 0x01}},  // 1.011 vs 0.500
+    {0x4dc9efbb46568b3full, 179, 163, 3, {0x31, 0x22, 0x0c}},  // 1.018 vs 0.500
+    {0x6097f1eaa4c6ba75ull, 475, 44, 2, {0x51, 0x15}},  // 1.010 vs 0.500
+    {0x69e02785001bba3dull, 391, 218, 4, {0x24, 0x05, 0x15, 0x42}},  // 1.020 vs 0.500
+    {0x6a9c5220f791673full, 70, 121, 5, {0x29, 0x15, 0x05, 0x1c, 0x0d}},  // 1.018 vs 0.500
+    {0x70c18c54b05c8bd1ull, 440, 323, 5, {0x3d, 0x0d, 0x34, 0x44, 0x1d}},  // 1.014 vs 0.500
+    {0x752d36b601c1ac6full, 414, 481, 2, {0x21, 0x45}},  // 1.014 vs 0.500
+    {0xab714ec5d372391full, 389, 665, 4, {0x21, 0x15, 0x05, 0x2d}},  // 1.015 vs 0.500
+    {0xb94b39201e73a939ull, 214, 726, 3, {0x29, 0x35, 0x09}},  // 1.017 vs 0.500
+    {0xbd3cd4f79a476511ull, 153, 384, 3, {0x3d, 0x1c, 0x2c}},  // 1.021 vs 0.500
+    {0xd110caae2f529987ull, 277, 598, 2, {0x32, 0x22}},  // 1.020 vs 0.500
+    {0xd146d73ddbfd2d55ull, 188, 465, 2, {0x11, 0x25}},  // 1.010 vs 0.500
+    {0xd6d35c60ee454f81ull, 45, 167, 6, {0x25, 0x0a, 0x15, 0x05, 0x1d, 0x2c}},  // 1.012 vs 0.500
+    {0xf4a28dc3907558c1ull, 334, 526, 1, {0x39}},  // 1.010 vs 0.500
+};
+constexpr int OPENING_BOOK_SIZE = sizeof(OPENING_BOOK) / sizeof(OPENING_BOOK[0]);
+// END OPENING BOOK
+
+// Plays a stored opening until the game leaves it. Maps are mirrored through their centre, so layouts are
+// hashed with every site folded onto the left half and both sides of a map share their lines.
+class OpeningBook
+{
+public:
+    OpeningBook() : _first(nullptr), _last(nullptr), _line(nullptr), _step(0) {}
+
+    static inline uint64_t siteKey(int x, int y, int radius)
+    {
+        return static_cast<uint64_t>(x) << 32 | static_cast<uint64_t>(y) << 16 | static_cast<uint64_t>(radius);
+    }
+
+    static uint64_t layoutHash(const GameState& layout)
+    {
+        uint64_t keys[MAX_SITES];
+        for(int siteId = 0; siteId < layout.numSites; ++siteId)
+        {
+            int x = layout.sites.x[siteId];
+            int y = layout.sites.y[siteId];
+            if(x * 2 > WORLD_WIDTH || (x * 2 == WORLD_WIDTH && y * 2 > WORLD_HEIGHT))
+            {
+                x = WORLD_WIDTH - x;
+                y = WORLD_HEIGHT - y;
+            }
+            keys[siteId] = siteKey(x, y, layout.sites.radius[siteId]);
+        }
+        std::sort(keys, keys + layout.numSites);
+        // FNV-1a over the sorted keys
+        uint64_t retVal = 0xcbf29ce484222325ull;
+        for(int cntSite = 0; cntSite < layout.numSites; ++cntSite)
+        {
+            retVal = (retVal ^ keys[cntSite]) * 0x100000001b3ull;
+        }
+        return retVal;
+    }
+
+    static inline bool isMirrored(const Position& queenStart) { return queenStart.x * 2 > WORLD_WIDTH; }
+
+    static inline Position canonicalPosition(const Position& pos, bool mirrored)
+    {
+        return mirrored ? Position(WORLD_WIDTH - pos.x, WORLD_HEIGHT - pos.y) : pos;
+    }
+
+    // Site ids by canonical index: sorted by position as seen from our side of the map.
+    static void siteOrder(const GameState& layout, bool mirrored, int order[MAX_SITES])
+    {
+        uint64_t keys[MAX_SITES];
+        for(int siteId = 0; siteId < layout.numSites; ++siteId)
+        {
+            const Position pos = canonicalPosition(layout.sitePosition(siteId), mirrored);
+            keys[siteId] = siteKey(pos.x, pos.y, layout.sites.radius[siteId]) << 5 | static_cast<uint64_t>(siteId);
+        }
+        std::sort(keys, keys + layout.numSites);
+        for(int cntSite = 0; cntSite < layout.numSites; ++cntSite)
+        {
+            order[cntSite] = static_cast<int>(keys[cntSite] & (MAX_SITES - 1));
+        }
+    }
+
+    static inline uint8_t packStep(int canonicalSite, StructureType sType)
+    {
+        return static_cast<uint8_t>(canonicalSite << 3 | static_cast<int>(sType));
+    }
+
+    // Finds the lines stored for the layout. Which one is played is known once the queen shows up.
+    void lookup(const GameState& layout)
+    {
+        const uint64_t hash = layoutHash(layout);
+        _first = std::lower_bound(OPENING_BOOK, OPENING_BOOK + OPENING_BOOK_SIZE, hash,
+                                  [](const OpeningLine& line, uint64_t key) { return line.layoutHash < key; });
+        _last = _first;
+        while(_last != OPENING_BOOK + OPENING_BOOK_SIZE && _last->layoutHash == hash)
+        {
+            ++_last;
+        }
+        _line = nullptr;
+        DBG_INFO("[BOOK] Layout " << LogHex{hash} << " has " << (_last - _first) << " opening lines.");
+    }
+
+    // Replaces the book's lines with a single one, or none.
+    void force(const OpeningLine* line)
+    {
+        _first = line;
+        _last = line ? line + 1 : line;
+        _line = nullptr;
+    }
+
+    void select(const GameState& state, const Position& queenStart)
+    {
+        const bool mirrored = isMirrored(queenStart);
+        const Position queen = canonicalPosition(queenStart, mirrored);
+        _line = nullptr;
+        _step = 0;
+        for(const OpeningLine* line = _first; line != _last; ++line)
+        {
+            if(line->queenX == queen.x && line->queenY == queen.y)
+            {
+                _line = line;
+                break;
+            }
+        }
+        if(_line)
+        {
+            siteOrder(state, mirrored, _order);
+            for(int step = 0; step < _line->nbSteps; ++step)
+            {
+                if((_line->steps[step] >> 3) >= state.numSites)
+                {
+                    DBG_ERROR("[BOOK] Opening line names a site the layout doesn't have.");
+                    _line = nullptr;
+                    return;
+                }
+            }
+            DBG_INFO("[BOOK] Playing a " << int(_line->nbSteps) << " step opening.");
+        }
+    }
+
+    inline bool isPlaying() const { return _line != nullptr; }
+
+    // The build order of the turn. A step is done once the site is ours with its structure - mines also
+    // have to reach their full size. The book is left for good when a site is taken or knights come out.
+    bool nextBuild(const GameState& state, bool threatened, int& siteId, StructureType& sType)
+    {
+        if(!_line)
+        {
+            return false;
+        }
+        if(threatened)
+        {
+            leave("enemy knights are out");
+            return false;
+        }
+        const GameState::Sites& sites = state.sites;
+        for(; _step < _line->nbSteps; ++_step)
+        {
+            siteId = _order[_line->steps[_step] >> 3];
+            sType = static_cast<StructureType>(_line->steps[_step] & 7);
+            if(sites.owner[siteId] == 0 && sites.type[siteId] == sType)
+            {
+                if(sType == StructureType::MINE && sites.param1[siteId] < sites.maxMineSize[siteId] && sites.gold[siteId] != 0)
+                {
+                    return true;
+                }
+                continue;
+            }
+            if(sites.type[siteId] != StructureType::EMPTY_SITE)
+            {
+                leave("a site of the line is taken");
+                return false;
+            }
+            return true;
+        }
+        leave("the line is played out");
+        return false;
+    }
+
+private:
+    inline void leave(const char* reason)
+    {
+        DBG_INFO("[BOOK] Leaving the opening at step " << _step << ": " << reason);
+        _line = nullptr;
+    }
+
+    const OpeningLine* _first;
+    const OpeningLine* _last;
+    const OpeningLine* _line;
+    int _step;
+    int _order[MAX_SITES];
+};
+
+
+// What every tower can shoot at: a mask of the sites a queen building there would be in range on, and a mask of
+// the map cells whose centre is in range. Both follow the tower's attack radius from the input and are only
+// recomputed when it changes, then merged per owner.
+class TowerCoverage
+{
+public:
+    static constexpr int cellSize = 50;
+    static constexpr int nbCellsX = (WORLD_WIDTH + cellSize - 1) / cellSize;
+    static constexpr int nbCellsY = (WORLD_HEIGHT + cellSize - 1) / cellSize;
+    using CellMask = std::bitset<nbCellsX * nbCellsY>;
+
+    void reset()
+    {
+        for(int siteId = 0; siteId < MAX_SITES; ++siteId)
+        {
+            _radius[siteId] = 0;
+            _owner[siteId] = -1;
+            _siteMask[siteId] = 0;
+            _cellMask[siteId].reset();
+        }
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            _towers[owner] = 0;
+            _teamSites[owner] = 0;
+            _teamCells[owner].reset();
+        }
+    }
+
+    void update(const GameState& state)
+    {
+        const GameState::Sites& sites = state.sites;
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            const bool isTower = sites.type[siteId] == StructureType::TOWER && sites.param1[siteId] > 0;
+            const int radius = isTower ? sites.param2[siteId] : 0;
+            const int owner = isTower ? sites.owner[siteId] : -1;
+            if(radius != _radius[siteId] || owner != _owner[siteId])
+            {
+                _radius[siteId] = radius;
+                _owner[siteId] = owner;
+                cover(state, siteId);
+            }
+        }
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            _towers[owner] = 0;
+            _teamSites[owner] = 0;
+            _teamCells[owner].reset();
+        }
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            const int owner = _owner[siteId];
+            if(owner >= 0)
+            {
+                _towers[owner] |= 1u << siteId;
+                _teamSites[owner] |= _siteMask[siteId];
+                _teamCells[owner] |= _cellMask[siteId];
+            }
+        }
+    }
+
+    // Sites in range of a tower of the owner.
+    inline uint32_t sitesUnderFire(int owner) const { return _teamSites[owner]; }
+    inline bool siteUnderFire(int siteId, int owner) const { return (_teamSites[owner] >> siteId) & 1; }
+    inline bool covers(const Position& pos, int owner) const { return _teamCells[owner].test(cellOf(pos)); }
+
+    // Towers of the owner whose range takes in the cell of pos.
+    int towersCovering(const Position& pos, int owner) const
+    {
+        const int cell = cellOf(pos);
+        int retVal = 0;
+        for(uint32_t towers = _towers[owner]; towers != 0; towers &= towers - 1)
+        {
+            retVal += _cellMask[__builtin_ctz(towers)].test(cell);
+        }
+        return retVal;
+    }
+
+private:
+    static inline int cellOf(const Position& pos)
+    {
+        const int cellX = std::min(std::max(pos.x / cellSize, 0), nbCellsX - 1);
+        const int cellY = std::min(std::max(pos.y / cellSize, 0), nbCellsY - 1);
+        return cellY * nbCellsX + cellX;
+    }
+
+    void cover(const GameState& state, int towerId)
+    {
+        const GameState::Sites& sites = state.sites;
+        const int radius = _radius[towerId];
+        const int tx = sites.x[towerId];
+        const int ty = sites.y[towerId];
+        _siteMask[towerId] = 0;
+        _cellMask[towerId].reset();
+        if(radius <= 0)
+        {
+            return;
+        }
+        for(int siteId = 0; siteId < state.numSites; ++siteId)
+        {
+            // a queen touching the site on the tower's side
+            const int reach = radius + sites.radius[siteId] + QUEEN_RADIUS;
+            const int dx = sites.x[siteId] - tx;
+            const int dy = sites.y[siteId] - ty;
+            _siteMask[towerId] |= dx*dx + dy*dy < reach*reach ? 1u << siteId : 0u;
+        }
+        // only the cells of the bounding box can have their centre in range
+        const int firstX = std::max((tx - radius) / cellSize, 0);
+        const int lastX = std::min((tx + radius) / cellSize, nbCellsX - 1);
+        const int firstY = std::max((ty - radius) / cellSize, 0);
+        const int lastY = std::min((ty + radius) / cellSize, nbCellsY - 1);
+        for(int cellY = firstY; cellY <= lastY; ++cellY)
+        {
+            const int dy = cellY * cellSize + cellSize / 2 - ty;
+            for(int cellX = firstX; cellX <= lastX; ++cellX)
+            {
+                const int dx = cellX * cellSize + cellSize / 2 - tx;
+                if(dx*dx + dy*dy < radius*radius)
+                {
+                    _cellMask[towerId].set(cellY * nbCellsX + cellX);
+                }
+            }
+        }
+    }
+
+    int _radius[MAX_SITES];
+    int _owner[MAX_SITES];
+    uint32_t _siteMask[MAX_SITES];
+    CellMask _cellMask[MAX_SITES];
+    uint32_t _towers[2];
+    uint32_t _teamSites[2];
+    CellMask _teamCells[2];
+};
+
+
+// Order in which the queen builds on a handful of target sites, minimising the sum of the turns at which each
+// one is done - the earlier a structure stands, the earlier it pays. Held-Karp over subsets, run backwards from
+// the last site so that the table only depends on the targets: it is kept while they and their build times stay
+// the same, and only the queen's first leg is priced again every turn.
+class TourPlanner
+{
+public:
+    static constexpr int maxTargets = 8;
+
+    TourPlanner() : _targetMask(0), _nbSites(0) {}
+
+    inline void reset() { _targetMask = 0; }
+
+    // Reorders targets into the planned visiting order. queenTurns and buildTurns go with the targets:
+    // the queen's walk to each of them and the turns spent building there.
+    void plan(const SiteDistanceTable& table, int* targets, int nbTargets, const int* queenTurns, const int* buildTurns)
+    {
+        nbTargets = std::min(nbTargets, maxTargets);
+        uint32_t targetMask = 0;
+        int first[MAX_SITES];
+        for(int cnt = 0; cnt < nbTargets; ++cnt)
+        {
+            targetMask |= 1u << targets[cnt];
+            first[targets[cnt]] = (queenTurns[cnt] + buildTurns[cnt]) * nbTargets;
+        }
+        bool sameBuilds = targetMask == _targetMask;
+        for(int cnt = 0; cnt < nbTargets && sameBuilds; ++cnt)
+        {
+            sameBuilds = _buildTurns[targets[cnt]] == buildTurns[cnt];
+        }
+        if(!sameBuilds)
+        {
+            _targetMask = targetMask;
+            for(int cnt = 0; cnt < nbTargets; ++cnt)
+            {
+                _buildTurns[targets[cnt]] = buildTurns[cnt];
+            }
+            solve(table);
+            DBG_INFO("[TOUR] New tour table for " << _nbSites << " sites.");
+        }
+
+        // the queen's leg to the first site is the only part that moves with her
+        const int full = (1 << _nbSites) - 1;
+        int current = 0;
+        int bestCost = std::numeric_limits<int>::max();
+        for(int idx = 0; idx < _nbSites; ++idx)
+        {
+            const int cost = first[_sites[idx]] + _cost[full ^ (1 << idx)][idx];
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                current = idx;
+            }
+        }
+        int remaining = full ^ (1 << current);
+        targets[0] = _sites[current];
+        for(int cnt = 1; cnt < _nbSites; ++cnt)
+        {
+            const int next = _next[remaining][current];
+            remaining ^= 1 << next;
+            current = next;
+            targets[cnt] = _sites[current];
+        }
+    }
+
+private:
+    // _cost[mask][last]: least summed completion turns to build mask after finishing at _sites[last].
+    // Every leg delays all the sites still to build, so it counts once for each of them.
+    void solve(const SiteDistanceTable& table)
+    {
+        _nbSites = 0;
+        for(uint32_t mask = _targetMask; mask != 0; mask &= mask - 1)
+        {
+            _sites[_nbSites++] = __builtin_ctz(mask);
+        }
+        int leg[maxTargets][maxTargets];
+        for(int from = 0; from < _nbSites; ++from)
+        {
+            for(int to = 0; to < _nbSites; ++to)
+            {
+                leg[from][to] = table.travelTurns[_sites[from]][_sites[to]] + _buildTurns[_sites[to]];
+            }
+        }
+        const int full = (1 << _nbSites) - 1;
+        for(int last = 0; last < _nbSites; ++last)
+        {
+            _cost[0][last] = 0;
+        }
+        for(int mask = 1; mask <= full; ++mask)
+        {
+            const int nbLeft = __builtin_popcount(mask);
+            for(int last = 0; last < _nbSites; ++last)
+            {
+                if(mask & (1 << last))
+                {
+                    continue;
+                }
+                int best = std::numeric_limits<int>::max();
+                for(int bits = mask; bits != 0; bits &= bits - 1)
+                {
+                    const int next = __builtin_ctz(bits);
+                    const int cost = leg[last][next] * nbLeft + _cost[mask ^ (1 << next)][next];
+                    if(cost < best)
+                    {
+                        best = cost;
+                        _next[mask][last] = static_cast<uint8_t>(next);
+                    }
+                }
+                _cost[mask][last] = best;
+            }
+        }
+    }
+
+    uint32_t _targetMask;
+    int _buildTurns[MAX_SITES];
+    int _nbSites;
+    int _sites[maxTargets];
+    int _cost[1 << maxTargets][maxTargets];
+    uint8_t _next[1 << maxTargets][maxTargets];
+};
+
+
+// What the enemy did, turn by turn, and what follows from it. Their gold is not in the input: it is carried from
+// turn to turn, adding the income of their mines and taking out the price of every batch seen starting to train.
+// Seeing them train what the estimate can't pay for means it was low, it is then floored at zero.
+class OpponentModel
+{
+public:
+    static constexpr int historySize = 64;
+    static constexpr int noWave = 1000;
+    static constexpr int unknownMineIncome = 2;  // enemy mines may not show their income
+
+    struct Snapshot
+    {
+        int16_t turn;
+        int16_t income;  // mined by the enemy during the turn before
+        int16_t spent;   // paid for the batches seen starting to train
+        int16_t gold;    // estimate, after the turn
+        int8_t countdown[MAX_SITES];  // enemy barracks countdowns, -1 elsewhere
+        uint32_t knightBarracks;
+        uint8_t creeps[3];            // enemy creeps alive, by UnitType
+    };
+
+    OpponentModel()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        _count = 0;
+        _incomeSum = 0;
+        _spentSum = 0;
+    }
+
+    void observe(const GameState& state)
+    {
+        const Snapshot* previous = _count > 0 ? &latest() : nullptr;
+        Snapshot& now = _history[_count % historySize];
+        if(_count >= historySize)
+        {
+            _incomeSum -= now.income;
+            _spentSum -= now.spent;
+        }
+        const Snapshot before = previous ? *previous : now;
+
+        const GameState::Sites& sites = state.sites;
+        int income = 0;
+        int spent = 0;
+        now.knightBarracks = 0;
+        for(int siteId = 0; siteId < MAX_SITES; ++siteId)
+        {
+            now.countdown[siteId] = -1;
+            if(siteId >= state.numSites || sites.owner[siteId] != 1)
+            {
+                continue;
+            }
+            const StructureType sType = sites.type[siteId];
+            if(sType == StructureType::MINE)
+            {
+                int rate = sites.param1[siteId] >= 0 ? sites.param1[siteId] : unknownMineIncome;
+                if(sites.gold[siteId] >= 0)
+                {
+                    rate = std::min(rate, sites.gold[siteId]);
+                }
+                income += rate;
+            }
+            else if(Simulator::isBarracks(sType))
+            {
+                const int countdown = sites.param1[siteId];
+                now.countdown[siteId] = static_cast<int8_t>(std::max(0, std::min(countdown, 127)));
+                now.knightBarracks |= sType == StructureType::BARRACKS_KNIGHT ? 1u << siteId : 0u;
+                // a running countdown only goes down - anything else is a new batch
+                if(countdown > 0 && (!previous || countdown >= before.countdown[siteId]))
+                {
+                    spent += creepStats(Simulator::trainedUnitType(sType)).cost;
+                }
+            }
+        }
+        std::memset(now.creeps, 0, sizeof(now.creeps));
+        for(int unitIdx = 0; unitIdx < state.numUnits; ++unitIdx)
+        {
+            if(state.units.owner[unitIdx] == 1 && state.units.type[unitIdx] != UnitType::QUEEN)
+            {
+                ++now.creeps[static_cast<int>(state.units.type[unitIdx])];
+            }
+        }
+        // both players start with the same gold
+        const int goldBefore = previous ? before.gold : state.gold[0];
+        now.turn = static_cast<int16_t>(state.turn);
+        now.income = static_cast<int16_t>(previous ? income : 0);
+        now.spent = static_cast<int16_t>(spent);
+        now.gold = static_cast<int16_t>(std::min(std::max(goldBefore + now.income - spent, 0), 30000));
+        _incomeSum += now.income;
+        _spentSum += now.spent;
+        ++_count;
+        DBG_INFO("[OPPONENT] Estimated gold " << now.gold << ", income " << now.income << ", spent " << now.spent
+                 << ", next knights in " << turnsToKnightWave() << " turns");
+    }
+
+    inline bool empty() const { return _count == 0; }
+    inline const Snapshot& latest() const { return _history[(_count - 1) % historySize]; }
+    inline int estimatedGold() const { return _count > 0 ? latest().gold : 0; }
+    inline int nbTurnsKept() const { return std::min(_count, historySize); }
+    inline double averageIncome() const { return _count > 0 ? static_cast<double>(_incomeSum) / nbTurnsKept() : 0.0; }
+    inline double averageSpent() const { return _count > 0 ? static_cast<double>(_spentSum) / nbTurnsKept() : 0.0; }
+
+    // Turns until the next enemy knights spawn: the shortest countdown of their knight barracks, or for an idle
+    // one the turns to afford a batch at the current income plus its training time. noWave without knight barracks.
+    int turnsToKnightWave() const
+    {
+        if(_count == 0)
+        {
+            return noWave;
+        }
+        const Snapshot& now = latest();
+        const CreepStats& knights = creepStats(UnitType::KNIGHT);
+        int turnsToAfford = 0;
+        if(now.gold < knights.cost)
+        {
+            const int income = std::max<int>(now.income, 0);
+            turnsToAfford = income > 0 ? (knights.cost - now.gold + income - 1) / income : noWave;
+        }
+        int retVal = noWave;
+        for(uint32_t barracks = now.knightBarracks; barracks != 0; barracks &= barracks - 1)
+        {
+            const int countdown = now.countdown[__builtin_ctz(barracks)];
+            retVal = std::min(retVal, countdown > 0 ? countdown : turnsToAfford + knights.buildTime);
+        }
+        return std::min(retVal, noWave);
+    }
+
+private:
+    Snapshot _history[historySize];
+    int _count;
+    int _incomeSum;  // over the snapshots kept
+    int _spentSum;
+};
+
+
+using UnitGrid = Map<WORLD_WIDTH, WORLD_HEIGHT, 100, MAX_UNITS>;
+using SiteGrid = Map<WORLD_WIDTH, WORLD_HEIGHT, 100, MAX_SITES>;
+
+class GameContext
+{
+public:
+    explicit GameContext(int inFd = STDIN_FILENO, int outFd = STDOUT_FILENO) :
+        _in(inFd),
+        _out(outFd),
+        _currentTurn(0),
+        _queenOrdered(false),
+        _gameEnded(false),
+        _hasPreviousTurn(false),
+        _params(STRATEGY_PARAMS),
+        _saveGold(0),
+        _queenStartingHp(0),
+        _maxSiteRadius(0),
+        _hasPonderedAction(false)
+    {
+        std::memset(&_state, 0, sizeof(_state));
+        _beamSearch.setSiteTable(&_siteTable);
+    }
+
+    inline void readInit()
+    {
+        int numSites = _in.readInt();
+        DBG_INPUT(numSites);
+        _state.numSites = 0;
+        for(auto cntSite = 0 ; cntSite < numSites ; ++cntSite)
+        {
+            int siteId = _in.readInt();
+            int x = _in.readInt();
+            int y = _in.readInt();
+            int radius = _in.readInt();
+            DBG_INPUT(siteId << " " << x << " " << y << " " << radius);
+            if(siteId < 0 || siteId >= MAX_SITES)
+            {
+                DBG_ERROR("Site id " << siteId << " doesn't fit in the game state.");
+                continue;
+            }
+            _state.sites.x[siteId] = x;
+            _state.sites.y[siteId] = y;
+            _state.sites.radius[siteId] = radius;
+            _state.numSites = std::max(_state.numSites, siteId + 1);
+        }
+        initSites();
+        _recorder.writeInit(_state);
+    }
+
+    // Takes the static site layout from an already parsed state instead of stdin.
+    inline void loadSites(const GameState& layout)
+    {
+        _state.numSites = layout.numSites;
+        for(int siteId = 0; siteId < layout.numSites; ++siteId)
+        {
+            _state.sites.x[siteId] = layout.sites.x[siteId];
+            _state.sites.y[siteId] = layout.sites.y[siteId];
+            _state.sites.radius[siteId] = layout.sites.radius[siteId];
+        }
+        initSites();
+    }
+
+    inline void initSites()
+    {
+        _hasPreviousTurn = false;
+        _maxSiteRadius = 0;
+        _siteGrid.clear();
+        for(int siteId = 0; siteId < _state.numSites; ++siteId)
+        {
+            _maxSiteRadius = std::max(_maxSiteRadius, _state.sites.radius[siteId]);
+            _siteGrid.insert(siteId, _state.sites.x[siteId], _state.sites.y[siteId]);
+        }
+        _siteTable.build(_state);
+        _pathFinder.build(_state);
+        _siteTable.useRoutes(_pathFinder);
+        _openingBook.lookup(_state);
+        _towerCoverage.reset();
+        _tourPlanner.reset();
+        _opponent.reset();
+    }
+
+    inline bool startRecording(const char* path) { return _recorder.open(path); }
+    // Searches the predicted next turn while waiting for its input. Call after readInit - the worker shares the site table.
+    inline void enablePondering() { _ponderer.start(&_siteTable); }
+    // Plays the given opening instead of the book's lines, none when null. Call after the sites are known.
+    inline void useOpening(const OpeningLine* line) { _openingBook.force(line); }
+    // Caps the number of sequences the beam search scores per turn, -1 for no cap. Makes replays deterministic.
+    inline void setSearchEvaluationLimit(int maxEvaluations) { _beamSearch.setEvaluationLimit(maxEvaluations); }
+    inline void setStrategyParams(const StrategyParams& params) { _params = params; }
+    inline const PlayerCommands& getCommands() const { return _commands; }
+    inline const TurnDeadline& getDeadline() const { return _deadline; }
+    inline const TeamState& getFriendlyTeam() const { return _friendlyTeam; }
+    inline const TeamState& getEnemyTeam() const { return _enemyTeam; }
+    inline const SiteList& getEmptySites() const { return _emptySites; }
+    inline int getNumSites() { return _state.numSites; }
+    inline int getAvailableGold() { return _state.gold[0] - _saveGold; }
+
+    inline void readSiteFromInput()
+    {
+        int siteId = _in.readInt();
+        int goldAvailable = _in.readInt(); // used in future leagues
+        int maxMineSize = _in.readInt(); // used in future leagues
+        int structureType = _in.readInt(); // -1 = No structure, 0 = Mine, 1 = Tower, 2 = Barracks
+        int owner = _in.readInt(); // -1 = No structure, 0 = Friendly, 1 = Enemy
+        int param1 = _in.readInt(); // in case of barracks - turns until train, in case of tower - hp, in case of mine - income rate
+        int param2 = _in.readInt(); // in case of barracks - barrack type - 0 for KNIGHT, 1 for ARCHER, in case of tower - attack radius
+        DBG_INPUT(siteId << " " << goldAvailable << " " << maxMineSize << " " << structureType << " " << owner << " " << param1 << " " << param2);
+
+        if(siteId < 0 || siteId >= _state.numSites)
+        {
+            DBG_ERROR("Unknown site id " << siteId);
+            return;
+        }
+
+        StructureType sType = StructureType::EMPTY_SITE;
+        switch (structureType)
+        {
+            case 0:
+                sType = StructureType::MINE;
+                break;
+            case 1:
+                sType = StructureType::TOWER;
+                break;
+            case 2:
+            {
+                switch (param2)
+                {
+                    case 0:
+                        sType = StructureType::BARRACKS_KNIGHT;
+                        break;
+                    case 1:
+                        sType = StructureType::BARRACKS_ARCHER;
+                        break;
+                    case 2:
+                        sType = StructureType::BARRACKS_GIANT;
+                        break;
+                }
+            }
+        }
+
+        GameState::Sites& sites = _state.sites;
+        sites.gold[siteId] = goldAvailable;
+        sites.maxMineSize[siteId] = maxMineSize;
+        sites.type[siteId] = sType;
+        sites.owner[siteId] = sType == StructureType::EMPTY_SITE ? -1 : owner;
+        sites.param1[siteId] = param1;
+        sites.param2[siteId] = param2;
+        _siteSets.classify(sites, siteId, _params.towerDesiredHp);
+    }
+
+    inline void readUnitFromInput()
+    {
+        int x = _in.readInt();
+        int y = _in.readInt();
+        int owner = _in.readInt();
+        int unitTypeInt = _in.readInt(); // -1 = QUEEN, 0 = KNIGHT, 1 = ARCHER, 2 = GIANT
+        int health = _in.readInt();
+        DBG_INPUT(x << " " << y << " " << owner << " " << unitTypeInt << " " << health);
+
+        UnitType uType;
+        switch (unitTypeInt)
+        {
+            case -1:
+                uType = UnitType::QUEEN;
+                break;
+            case 0:
+                uType = UnitType::KNIGHT;
+                break;
+            case 1:
+                uType = UnitType::ARCHER;
+                break;
+            case 2:
+                uType = UnitType::GIANT;
+                break;
+            default:
+                DBG_INFO("[GameContext::readUnitFromInput] Unexpected unit type: " << unitTypeInt);
+                return;
+        }
+        if(_state.numUnits >= MAX_UNITS)
+        {
+            DBG_ERROR("Too many units, dropping one.");
+            return;
+        }
+
+        GameState::Units& units = _state.units;
+        int unitIdx = _state.numUnits++;
+        units.x[unitIdx] = x;
+        units.y[unitIdx] = y;
+        units.owner[unitIdx] = owner;
+        units.type[unitIdx] = uType;
+        units.hp[unitIdx] = health;
+    }
+
+    // Rebuild the per-team index lists from the flat state.
+    // Site lists persist across turns: only the sites whose owner or type changed move between them.
+    // Unit lists and the unit grid are rebuilt, units carry no id to follow them by.
+    inline void indexTeams()
+    {
+        const GameState::Sites& sites = _state.sites;
+        _changes.clear();
+        _changes.allSites = !_hasPreviousTurn;
+        if(_changes.allSites)
+        {
+            _friendlyTeam.resetSites();
+            _enemyTeam.resetSites();
+            _emptySites.clear();
+            for(int siteId = 0; siteId < _state.numSites; ++siteId)
+            {
+                siteListOf(sites.owner[siteId], sites.type[siteId]).push(siteId);
+            }
+        }
+        else
+        {
+            for(int siteId = 0; siteId < _state.numSites; ++siteId)
+            {
+                const uint32_t bit = 1u << siteId;
+                const bool ownerChanged = sites.owner[siteId] != _previousSites.owner[siteId];
+                const bool typeChanged = sites.type[siteId] != _previousSites.type[siteId];
+                _changes.ownerChanged |= ownerChanged ? bit : 0;
+                _changes.typeChanged |= typeChanged ? bit : 0;
+                _changes.param1Changed |= sites.param1[siteId] != _previousSites.param1[siteId] ? bit : 0;
+                if(ownerChanged || typeChanged)
+                {
+                    siteListOf(_previousSites.owner[siteId], _previousSites.type[siteId]).remove(siteId);
+                    siteListOf(sites.owner[siteId], sites.type[siteId]).push(siteId);
+                }
+                else if(sites.type[siteId] == StructureType::TOWER)
+                {
+                    _changes.towerHpDelta[siteId] = sites.param1[siteId] - _previousSites.param1[siteId];
+                }
+            }
+        }
+
+        const GameState::Units& units = _state.units;
+        _friendlyTeam.resetUnits();
+        _enemyTeam.resetUnits();
+        _unitGrid.clear();
+        for(int unitIdx = 0; unitIdx < _state.numUnits; ++unitIdx)
+        {
+            _unitGrid.insert(unitIdx, units.x[unitIdx], units.y[unitIdx]);
+            TeamState& targetTeamState = units.owner[unitIdx] == 0 ? _friendlyTeam : _enemyTeam;
+            switch (units.type[unitIdx])
+            {
+                case UnitType::KNIGHT:
+                    targetTeamState.knights.push(unitIdx);
+                    break;
+                case UnitType::ARCHER:
+                    targetTeamState.archers.push(unitIdx);
+                    break;
+                case UnitType::GIANT:
+                    targetTeamState.giants.push(unitIdx);
+                    break;
+                case UnitType::QUEEN:
+                    targetTeamState.queen = unitIdx;
+                    break;
+            }
+        }
 
-class GameContext
-{
-public:
-    GameContext() :
-        _gold(0),
-        _touchedSite(-1),
-        _currentTurn(0),
-        _queenOrdered(false),
-        _saveGold(0),
-        _queenStartingHp(0)
-    {
-        _emptySites.reserve(30);
+        const TeamState* teams[2] = {&_friendlyTeam, &_enemyTeam};
+        for(int owner = 0; owner < 2; ++owner)
+        {
+            const int unitCount[4] = {teams[owner]->knights.size(), teams[owner]->archers.size(), teams[owner]->giants.size(), teams[owner]->queen >= 0 ? 1 : 0};
+            for(int uType = 0; uType < 4; ++uType)
+            {
+                _changes.unitCountDelta[owner][uType] = _hasPreviousTurn ? unitCount[uType] - _previousUnitCount[owner][uType] : 0;
+                _previousUnitCount[owner][uType] = unitCount[uType];
+            }
+        }
+        if(_friendlyTeam.queen >= 0)
+        {
+            const Position queenPos = queenPosition();
+            _changes.queenMoved = !_hasPreviousTurn || queenPos.x != _previousQueenPosition.x || queenPos.y != _previousQueenPosition.y;
+            _previousQueenPosition = queenPos;
+        }
+
+        _towerCoverage.update(_state);
+        _previousSites = sites;
+        _hasPreviousTurn = true;
+        DBG_INFO("[TRACK] " << __builtin_popcount(_changes.structureChanged()) << " sites changed owner or type, "
+                 << __builtin_popcount(_changes.param1Changed) << " changed param1, queen moved " << _changes.queenMoved);
     }
 
-    inline void readInit()
+    inline SiteList& siteListOf(int owner, StructureType sType)
     {
-        int numSites;
-        std::cin >> numSites; std::cin.ignore();
-        DBG_INPUT(numSites);
-        for(auto cntSite = 0 ; cntSite < numSites ; ++cntSite)
+        if(sType == StructureType::EMPTY_SITE)
         {
-            int siteId;
-            StructureInitialInfo sInfo;
-            std::cin >> siteId >> sInfo.pos.x >> sInfo.pos.y >> sInfo.radius; std::cin.ignore();
-            DBG_INPUT(siteId << " " << sInfo.pos.x << " " << sInfo.pos.y << " " << sInfo.radius);
-            _sInfo[siteId] = sInfo;
+            return _emptySites;
         }
+        return (owner == 0 ? _friendlyTeam : _enemyTeam).sitesOf(sType);
     }
-    inline int getNumSites() { return _sInfo.size(); }
-    inline int getAvailableGold() { return _gold - _saveGold; }
-    inline void readTurnInput()
+
+    inline const TurnChanges& getTurnChanges() const { return _changes; }
+    inline const SiteSets& getSiteSets() const { return _siteSets; }
+
+    inline bool readTurnInput()
     {
+        PROFILE_SCOPE("input");
         DBG_INFO("[INPUT] Starting input parsing.");
-        DBG_INFO("[INPUT] Reset team state.");
-        _friendlyTeam.reset();
-        _enemyTeam.reset();
-        _emptySites.clear();
-
-        std::cin >> _gold >> _touchedSite; std::cin.ignore();
-        DBG_INPUT(_gold << " " << _touchedSite);
-        DBG_INFO("[STRAT] Gold: " << _gold << " touching site: " << _touchedSite);
+        _state.turn = _currentTurn;
+        _state.gold[0] = _in.readInt();
+        _state.touchedSite[0] = _in.readInt();
+        if(_in.eof())
+        {
+            return false;
+        }
+        DBG_INPUT(_state.gold[0] << " " << _state.touchedSite[0]);
+        DBG_INFO("[STRAT] Gold: " << _state.gold[0] << " touching site: " << _state.touchedSite[0]);
         int numSites = getNumSites();
-        DBG_INFO("[INPUT] Creating site objects");
-        for (auto cntSite = 0; cntSite < numSites; ++cntSite)
+        DBG_INFO("[INPUT] Reading sites");
+        _siteSets.clear();
         {
-            // create derived class object
-            std::shared_ptr<Structure> newStructure = Structure::createStructureFromInput(_sInfo);
-            if(newStructure)
-            {
-                //newStructure->print();
-
-                // put it in apropriate place
-                TeamState& targetTeamState = newStructure->getTeam() == 0 ? _friendlyTeam : _enemyTeam;
-
-                const StructureType sType = newStructure->getType();
-                switch (sType)
-                {
-                    case StructureType::EMPTY_SITE:
-                        _emptySites.emplace_back(std::static_pointer_cast<EmptySite>(newStructure));
-                        break;
-                    case StructureType::BARRACKS_KNIGHT:
-                        targetTeamState.barracksKnights.emplace_back(std::static_pointer_cast<BarracksKnights>(newStructure));
-                        break;
-                    case StructureType::BARRACKS_ARCHER:
-                        targetTeamState.barracksArchers.emplace_back(std::static_pointer_cast<BarracksArchers>(newStructure));
-                        break;
-                    case StructureType::BARRACKS_GIANT:
-                        targetTeamState.barracksGiants.emplace_back(std::static_pointer_cast<BarracksGiants>(newStructure));
-                        break;
-                    case StructureType::TOWER:
-                        targetTeamState.towers.emplace_back(std::static_pointer_cast<Tower>(newStructure));
-                        break;
-                    case StructureType::MINE:
-                        targetTeamState.mines.emplace_back(std::static_pointer_cast<Mine>(newStructure));
-                        break;
-                }
-            }
-            else
+            PROFILE_SCOPE("sites");
+            for (auto cntSite = 0; cntSite < numSites; ++cntSite)
             {
-                DBG_INFO("[ERROR] Can't create structure object.");
+                readSiteFromInput();
             }
         }
-        DBG_INFO("[INPUT] Finished creating site objects.");
-
-        int numUnits;
+        DBG_INFO("[INPUT] Finished reading sites.");
 
-        std::cin >> numUnits; std::cin.ignore();
+        int numUnits = _in.readInt();
         DBG_INPUT(numUnits);
 
-        DBG_INFO("[INPUT] Start creating unit objects.");
-        for(auto cntUnit = 0; cntUnit < numUnits; ++cntUnit)
+        DBG_INFO("[INPUT] Start reading units.");
+        _state.numUnits = 0;
         {
-            std::shared_ptr<Unit> newUnit = Unit::createUnitFromInput();
-
-            TeamState& targetTeamState = newUnit->getTeam() == 0 ? _friendlyTeam : _enemyTeam;
-            switch (newUnit->getType())
+            PROFILE_SCOPE("units");
+            for(auto cntUnit = 0; cntUnit < numUnits; ++cntUnit)
             {
-                case UnitType::KNIGHT:
-                    targetTeamState.knights.emplace_back(std::static_pointer_cast<Knight>(newUnit));
-                    break;
-                case UnitType::ARCHER:
-                    targetTeamState.archers.emplace_back(std::static_pointer_cast<Archer>(newUnit));
-                    break;
-                case UnitType::GIANT:
-                    targetTeamState.giants.emplace_back(std::static_pointer_cast<Giant>(newUnit));
-                    break;
-                case UnitType::QUEEN:
-                    targetTeamState.queen = std::static_pointer_cast<Queen>(newUnit);
-                    break;
+                readUnitFromInput();
             }
         }
-        DBG_INFO("[INPUT] Finished creating unit objects.");
+        DBG_INFO("[INPUT] Finished reading units.");
+
+        indexTeams();
+        return !_in.eof() && _friendlyTeam.queen >= 0;
     }
 
     inline void queenWAIT()
     {
         if(!_queenOrdered)
         {
-            std::cout << "WAIT" << std::endl;
+            _commands.queen = QueenAction::wait();
             _queenOrdered = true;
         }
     }
@@ -543,7 +5602,7 @@ public:
     {
         if(!_queenOrdered)
         {
-            std::cout << "MOVE " << pos.x << " " << pos.y << std::endl;
+            _commands.queen = QueenAction::move(pos);
             _queenOrdered = true;
         }
     }
@@ -551,57 +5610,231 @@ public:
     {
         if(!_queenOrdered)
         {
-            std::cout << "BUILD " << siteId << " " << structureTypeToString(sType) << std::endl;
+            _commands.queen = QueenAction::build(siteId, sType);
             _queenOrdered = true;
         }
     }
+    inline void barracksTRAIN(int siteId)
+    {
+        _commands.trainMask |= 1u << siteId;
+    }
+
+    inline void writeCommands()
+    {
+        PROFILE_SCOPE("output");
+        const QueenAction& queen = _commands.queen;
+        switch (queen.type)
+        {
+            case QueenActionType::WAIT:
+                _out << "WAIT\n";
+                break;
+            case QueenActionType::MOVE:
+                _out << "MOVE " << queen.x << ' ' << queen.y << '\n';
+                break;
+            case QueenActionType::BUILD:
+                _out << "BUILD " << queen.siteId << ' ' << structureTypeToString(queen.sType) << '\n';
+                break;
+        }
+        _out << "TRAIN";
+        for(int siteId = 0; siteId < MAX_SITES; ++siteId)
+        {
+            if(_commands.trainMask & (1u << siteId))
+            {
+                _out << ' ' << siteId;
+            }
+        }
+        _out << '\n';
+        _out.flush();
+    }
 
     inline void measureTime(const char* text)
     {
-        _measurePoint = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> actionTime = std::chrono::duration_cast<std::chrono::microseconds>(_measurePoint-_startTurn);
-        DBG_INFO(text << std::fixed << actionTime.count());
+        DBG_INFO(text << _deadline.elapsed().count());
     }
 
-    template<typename ObjectWithPos>
-    inline int getNumberOfUnitsInRange(const std::shared_ptr<ObjectWithPositionAndRadius> target,
-                                       const std::vector<std::shared_ptr<ObjectWithPos>> objects,
-                                       int range)
+    inline Position queenPosition() const { return _state.unitPosition(_friendlyTeam.queen); }
+
+    inline int queenDistanceToSite(int siteId) const
     {
-        int retVal = 0;
+        return distanceBetween(queenPosition(), unitRadius(UnitType::QUEEN), _state.sitePosition(siteId), _state.sites.radius[siteId]);
+    }
+
+    // Sort keys for the turn: one sqrt per site instead of two per comparison.
+    // Knights have no radius for the strategy, so their squared centre distance orders them the same way.
+    inline void computeQueenDistanceKeys()
+    {
+        const Position queenPos = queenPosition();
+        // sites don't move, so their keys only follow the queen
+        if(_changes.queenMoved)
+        {
+            _pathFinder.distancesToSites(queenPos, _queenSiteDistance);
+        }
+        for(int knightIdx : _enemyTeam.knights)
+        {
+            const int dx = _state.units.x[knightIdx] - queenPos.x;
+            const int dy = _state.units.y[knightIdx] - queenPos.y;
+            _queenUnitDistanceSq[knightIdx] = dx*dx + dy*dy;
+        }
+    }
+
+    // Both sorts use the keys of computeQueenDistanceKeys().
+    inline void sortSitesByQueenDistance(SiteList& sites) const
+    {
+        std::sort(sites.begin(), sites.end(), [&](int a, int b) -> bool
+        {
+            return _queenSiteDistance[a] < _queenSiteDistance[b];
+        });
+    }
 
-        for(const std::shared_ptr<ObjectWithPos>& objPtr : objects)
+    // While mines are wanted, the closest sites with gold - one more than mines are missing, in case one is
+    // contested - go first in the order of the planned tour, each priced at its full mine size.
+    // Barracks and towers are single builds wherever the strategy wants them, so they keep the distance order.
+    inline void planBuildTour(int nbMinesWanted)
+    {
+        constexpr int spareTargets = 1;
+        if(nbMinesWanted <= 0)
+        {
+            return;
+        }
+        PROFILE_SCOPE("tour");
+        const int wanted = std::min(nbMinesWanted + spareTargets, TourPlanner::maxTargets);
+        int targets[TourPlanner::maxTargets];
+        int queenTurns[TourPlanner::maxTargets];
+        int buildTurns[TourPlanner::maxTargets];
+        int nbTargets = 0;
+        for(int cnt = 0; cnt < _emptySites.size() && nbTargets < wanted; ++cnt)
         {
-            if(target->distanceTo(*objPtr) < range)
+            const int siteId = _emptySites[cnt];
+            if(!SiteSets::contains(_siteSets.goldLeft, siteId))
             {
-                ++retVal;
+                continue;
+            }
+            const int walk = std::max(0, _queenSiteDistance[siteId] - CONTACT_RANGE);
+            targets[nbTargets] = siteId;
+            queenTurns[nbTargets] = (walk + QUEEN_SPEED - 1) / QUEEN_SPEED;
+            buildTurns[nbTargets] = std::max(1, _state.sites.maxMineSize[siteId]);
+            ++nbTargets;
+        }
+        if(nbTargets < 2)
+        {
+            return;
+        }
+        _tourPlanner.plan(_siteTable, targets, nbTargets, queenTurns, buildTurns);
+        // the toured sites first, the others after them in their distance order
+        uint8_t* sites = _emptySites.begin();
+        uint32_t toured = 0;
+        for(int cnt = 0; cnt < nbTargets; ++cnt)
+        {
+            toured |= 1u << targets[cnt];
+        }
+        uint8_t others[MAX_SITES];
+        int nbOthers = 0;
+        for(int cnt = 0; cnt < _emptySites.size(); ++cnt)
+        {
+            if(!SiteSets::contains(toured, sites[cnt]))
+            {
+                others[nbOthers++] = sites[cnt];
             }
         }
+        std::copy(targets, targets + nbTargets, sites);
+        std::copy(others, others + nbOthers, sites + nbTargets);
+    }
+
+    inline void sortKnightsByQueenDistance(UnitList& knights) const
+    {
+        std::sort(knights.begin(), knights.end(), [&](int a, int b) -> bool
+        {
+            return _queenUnitDistanceSq[a] < _queenUnitDistanceSq[b];
+        });
+    }
+
+    inline int queenDistanceToUnit(int unitIdx) const
+    {
+        return distanceBetween(queenPosition(), unitRadius(UnitType::QUEEN), _state.unitPosition(unitIdx), unitRadius(_state.units.type[unitIdx]));
+    }
+
+    // Same test as distanceBetween(...) < range, done on squared centre distances through the grid.
+    inline int getNumberOfUnitsInRange(const Position& pos, int radius, int owner, UnitType uType, int range)
+    {
+        const int reach = range + radius + unitRadius(uType);
+        int retVal = _unitGrid.countInRange(pos.x, pos.y, reach, [&](int unitIdx) -> bool
+        {
+            return _state.units.owner[unitIdx] == owner && _state.units.type[unitIdx] == uType;
+        });
         DBG_INFO("Number of units in range(" << range << ") - " << retVal);
         return retVal;
     }
 
-    template<typename ObjectWithPos>
-    inline Position getAveragePosition(const std::vector<std::shared_ptr<ObjectWithPos>> objects)
+    inline int getNumberOfSitesInRange(const Position& pos, int radius, int owner, StructureType sType, int range)
+    {
+        const int reach = range + radius;
+        int retVal = _siteGrid.countInRange(pos.x, pos.y, reach + _maxSiteRadius, [&](int siteId) -> bool
+        {
+            const int siteReach = reach + _state.sites.radius[siteId];
+            const int dx = _state.sites.x[siteId] - pos.x;
+            const int dy = _state.sites.y[siteId] - pos.y;
+            return _state.sites.owner[siteId] == owner && _state.sites.type[siteId] == sType && dx*dx + dy*dy < siteReach*siteReach;
+        });
+        DBG_INFO("Number of sites in range(" << range << ") - " << retVal);
+        return retVal;
+    }
+
+    inline Position getAveragePosition(const SiteList& sites) const
     {
         Position retVal;
-        if(objects.size() > 0)
+        if(sites.size() > 0)
         {
             int avgX = 0;
             int avgY = 0;
-            for(const std::shared_ptr<ObjectWithPos>& obj : objects)
+            for(int siteId : sites)
             {
-                avgX += obj->getPosition().x;
-                avgY += obj->getPosition().y;
+                avgX += _state.sites.x[siteId];
+                avgY += _state.sites.y[siteId];
             }
-            avgX /= objects.size();
-            avgY /= objects.size();
+            avgX /= sites.size();
+            avgY /= sites.size();
             retVal.x = avgX;
             retVal.y = avgY;
         }
         return retVal;
     }
 
+    // Only worth stepping the simulator when enemy knights are out or about to spawn.
+    inline void updateCreepForecast()
+    {
+        PROFILE_SCOPE("forecast");
+        if(!_enemyTeam.knights.empty() || _siteSets.enemyKnightsTraining != 0)
+        {
+            _creepForecast.build(_state);
+        }
+        else
+        {
+            _creepForecast.clear();
+        }
+    }
+
+    // The average of our towers, unless one of the towers is predicted to see less knight damage
+    // or as little under the cover of more of our towers.
+    inline Position safestRetreat() const
+    {
+        Position retVal = getAveragePosition(_friendlyTeam.towers);
+        int leastDamage = _creepForecast.queenDamageWithin(retVal, CreepForecast::horizon);
+        int mostCover = _towerCoverage.towersCovering(retVal, 0);
+        for(int towerId : _friendlyTeam.towers)
+        {
+            const Position towerPos = _state.sitePosition(towerId);
+            const int damage = _creepForecast.queenDamageWithin(towerPos, CreepForecast::horizon);
+            const int cover = _towerCoverage.towersCovering(towerPos, 0);
+            if(damage < leastDamage || (damage == leastDamage && cover > mostCover))
+            {
+                leastDamage = damage;
+                mostCover = cover;
+                retVal = towerPos;
+            }
+        }
+        return retVal;
+    }
+
     Position getPivotPosition(const Position& source, const Position& object)
     {
         Position retVal;
@@ -625,25 +5858,32 @@ public:
     inline void takeAction()
     {
         //constexpr int avgGoldPerBarracks = 80;
-        constexpr int nbEnemyTowersTriggerGiant = 6;
-        constexpr int nbFriendlyTowersMax = 5;
-        constexpr int nbArchersMax = 2;
-        int nbStartingMines = _queenStartingHp / 20 + 1;
-        constexpr int minAvgArcherHp = 10;
+        const StrategyParams& params = _params;
+        const int nbStartingMines = _queenStartingHp / std::max(1, params.queenHpPerStartingMine) + 1;
         constexpr int priceOfArchers = 100;
         constexpr int priceOfKnights = 80;
         constexpr int priceOfGiant = 140;
-        constexpr int queenSafeRange = 90;
-        constexpr int towerDesiredHp = 220;
+        constexpr int fleeForecastTurns = 2;
         //bool twoWaveTactic = true;
 
         measureTime("[TIME] Start take action: ");
+        computeQueenDistanceKeys();
+        updateCreepForecast();
         _queenOrdered = false;
+        _commands = PlayerCommands();
         _saveGold = 0;
+        int bookSiteId;
+        StructureType bookType;
+        const bool fromBook = _openingBook.nextBuild(_state, !_enemyTeam.knights.empty(), bookSiteId, bookType);
+        if(fromBook)
+        {
+            DBG_INFO("[BOOK] Building " << structureTypeToString(bookType) << " on site " << bookSiteId);
+            queenBUILD(bookSiteId, bookType);
+        }
         int averageHealthArchers = 0;
-        for(const std::shared_ptr<Archer>& archerPtr : _friendlyTeam.archers)
+        for(int archerIdx : _friendlyTeam.archers)
         {
-            averageHealthArchers+= archerPtr->getHealth();
+            averageHealthArchers+= _state.units.hp[archerIdx];
         }
         if(_friendlyTeam.archers.size() > 0)
         {
@@ -654,27 +5894,18 @@ public:
         {
             averageHealthArchers = 100;
         }
-        bool archersExpiringSoon = !_friendlyTeam.archers.empty() && averageHealthArchers < minAvgArcherHp;
-        bool enemyIsAggressive = _enemyTeam.knights.size() > 0;
-        if(!enemyIsAggressive)
-        {
-            for(const std::shared_ptr<BarracksKnights>& barracksPtr: _enemyTeam.barracksKnights)
-            {
-                if(barracksPtr->getTurnsUntilTrain() > 0)
-                {
-                    enemyIsAggressive = true;
-                    break;
-                }
-            }
-        }
-        bool needArchers = enemyIsAggressive && (_friendlyTeam.archers.size() < nbArchersMax || archersExpiringSoon);
-        bool needGiants = _friendlyTeam.giants.empty() && _enemyTeam.towers.size() > nbEnemyTowersTriggerGiant;
+        bool archersExpiringSoon = !_friendlyTeam.archers.empty() && averageHealthArchers < params.minAvgArcherHp;
+        const int knightWaveTurns = _opponent.turnsToKnightWave();
+        // Archers are ordered just in time - once a wave is predicted - rather than only after knights show up.
+        bool enemyIsAggressive = _enemyTeam.knights.size() > 0 || _siteSets.enemyKnightsTraining != 0 || knightWaveTurns <= params.knightWaveLeadTurns;
+        bool needArchers = enemyIsAggressive && (_friendlyTeam.archers.size() < params.nbArchersMax || archersExpiringSoon);
+        bool needGiants = _friendlyTeam.giants.empty() && _enemyTeam.towers.size() > params.nbEnemyTowersTriggerGiant;
 
         bool needArchersBarracks = needArchers && _friendlyTeam.barracksArchers.empty();
         bool needGiantsBarracks = needGiants && _friendlyTeam.barracksGiants.empty();
-        int neededArchers = neededArchers ? 1 : 0;
-        int neededGiants = neededGiants ? 1 : 0;
-        int freeGold = _gold - (priceOfArchers * neededArchers + priceOfGiant * neededGiants);
+        int neededArchers = needArchers ? 1 : 0;
+        int neededGiants = needGiants ? 1 : 0;
+        int freeGold = _state.gold[0] - (priceOfArchers * neededArchers + priceOfGiant * neededGiants);
         int currentFreeGoldCapacity = freeGold - priceOfKnights*_friendlyTeam.barracksKnights.size();
         int neededKnightBarracks = currentFreeGoldCapacity / priceOfKnights;
         bool needKnightsBarracks = _friendlyTeam.barracksKnights.size() < neededKnightBarracks;
@@ -685,74 +5916,49 @@ public:
 
             // sort the empty places by distance from the queen
             DBG_INFO("[STRAT] Sorting empty sites by distance to our queen...");
-            std::sort(_emptySites.begin(), _emptySites.end(),
-                      [&](const std::shared_ptr<EmptySite>& a,
-                      const std::shared_ptr<EmptySite>& b) -> bool
-            {
-                return _friendlyTeam.queen->distanceTo(*a) < _friendlyTeam.queen->distanceTo(*b);
-            });
+            sortSitesByQueenDistance(_emptySites);
+            planBuildTour(nbStartingMines - _friendlyTeam.mines.size());
             measureTime("[TIME] End empty site sort: ");
 
-            bool minesCanBeUpgraded = false;
-            for(const std::shared_ptr<Mine>& minePtr : _friendlyTeam.mines)
-            {
-                if(minePtr->getMineSize() < minePtr->getMaxMineSize())
-                {
-                    minesCanBeUpgraded = true;
-                    break;
-                }
-            }
-
-            bool towersCanBeUpgraded = false;
-            for(const std::shared_ptr<Tower>& towerPtr : _friendlyTeam.towers)
-            {
-                if(towerPtr->getHealth() < towerDesiredHp)
-                {
-                    towersCanBeUpgraded = true;
-                    break;
-                }
-            }
+            const bool minesCanBeUpgraded = _siteSets.upgradableMines != 0;
+            const bool towersCanBeUpgraded = _siteSets.weakTowers != 0;
 
             bool queenIsSafe = true;
             if(!_enemyTeam.knights.empty())
             {
                 // sort the enemy knigts by distance from the queen
                 measureTime("[STRAT] Sorting knights by distance to our queen -> ");
-                std::sort(_enemyTeam.knights.begin(), _enemyTeam.knights.end(),
-                          [&](const std::shared_ptr<Knight>& a,
-                          const std::shared_ptr<Knight>& b) -> bool
-                {
-                    return _friendlyTeam.queen->distanceTo(*a) < _friendlyTeam.queen->distanceTo(*b);
-                });
-                if(_friendlyTeam.queen->distanceTo(*_enemyTeam.knights.front()) < queenSafeRange)
+                sortKnightsByQueenDistance(_enemyTeam.knights);
+                if(queenDistanceToUnit(_enemyTeam.knights.front()) < params.queenSafeRange)
                 {
                     DBG_INFO("[STRAT]A knight is close to our queen - she is not safe");
                     queenIsSafe = false;
                 }
             }
+            if(queenIsSafe && _creepForecast.queenDamageWithin(queenPosition(), params.forecastSafetyTurns) > 0)
+            {
+                DBG_INFO("[STRAT] Knights are predicted to reach our queen - she is not safe");
+                queenIsSafe = false;
+            }
             measureTime("[STRAT] Queen safety evaluated -> ");
 
 
             if(!_queenOrdered && queenIsSafe && minesCanBeUpgraded)
             {
+                PROFILE_SCOPE("mines");
                 // sort the empty places by distance from the queen
                 DBG_INFO("[STRAT] Sorting mines by distance to our queen");
-                std::sort(_friendlyTeam.mines.begin(), _friendlyTeam.mines.end(),
-                          [&](const std::shared_ptr<Mine>& a,
-                          const std::shared_ptr<Mine>& b) -> bool
-                {
-                    return _friendlyTeam.queen->distanceTo(*a) < _friendlyTeam.queen->distanceTo(*b);
-                });
+                sortSitesByQueenDistance(_friendlyTeam.mines);
 
-                for(const std::shared_ptr<Mine>& minePtr : _friendlyTeam.mines)
+                for(int mineId : _friendlyTeam.mines)
                 {
-                    if(minePtr->getMineSize() < minePtr->getMaxMineSize())
+                    if(SiteSets::contains(_siteSets.upgradableMines, mineId))
                     {
-                        DBG_INFO("Mine with id (" << minePtr->getSiteId() << ") is level "
-                                 << minePtr->getMineSize() << " of " << minePtr->getMaxMineSize()
+                        DBG_INFO("Mine with id (" << mineId << ") is level "
+                                 << _state.sites.param1[mineId] << " of " << _state.sites.maxMineSize[mineId]
                                  << ", attempting to upgrade.");
 
-                        queenBUILD(minePtr->getSiteId(), StructureType::MINE);
+                        queenBUILD(mineId, StructureType::MINE);
                         break;
                     }
                 }
@@ -760,15 +5966,16 @@ public:
             measureTime("[TIME]Upgrade mine evaluation finished -> ");
             if(!_queenOrdered && queenIsSafe && _friendlyTeam.mines.size() < nbStartingMines)
             {
+                PROFILE_SCOPE("mines");
                 DBG_INFO("[STRAT] Need more mines - lets expand");
-                for(const std::shared_ptr<EmptySite>& site : _emptySites)
+                for(int siteId : _emptySites)
                 {
-                    site->print();
-                    if(site->getGoldAvailable() != 0)
+                    _state.printSite(siteId);
+                    if(SiteSets::contains(_siteSets.goldLeft, siteId))
                     {
-                        if(getNumberOfUnitsInRange(site, _enemyTeam.knights, 120) == 0)
+                        if(getNumberOfUnitsInRange(_state.sitePosition(siteId), _state.sites.radius[siteId], 1, UnitType::KNIGHT, params.mineKnightDistance) == 0)
                         {
-                            queenBUILD(site->getSiteId(), StructureType::MINE);
+                            queenBUILD(siteId, StructureType::MINE);
                             break;
                         }
                     }
@@ -777,6 +5984,7 @@ public:
             measureTime("[TIME]Build mine evaluation finished -> ");
             if(!_queenOrdered && (needKnightsBarracks || needArchersBarracks || needGiantsBarracks))
             {
+                PROFILE_SCOPE("barracks");
                 StructureType newBarracksType = StructureType::BARRACKS_KNIGHT;
                 if(_friendlyTeam.barracksArchers.empty() && needArchersBarracks)
                 {
@@ -785,7 +5993,7 @@ public:
                 }
                 if(_friendlyTeam.barracksGiants.empty() && needGiantsBarracks)
                 {
-                    DBG_INFO("[STRAT] Enemy team has more than " << nbEnemyTowersTriggerGiant << " towers - lets create some giant barracks.");
+                    DBG_INFO("[STRAT] Enemy team has more than " << params.nbEnemyTowersTriggerGiant << " towers - lets create some giant barracks.");
                     newBarracksType = StructureType::BARRACKS_GIANT;
                 }
                 else if (needKnightsBarracks)
@@ -794,78 +6002,116 @@ public:
                     newBarracksType = StructureType::BARRACKS_KNIGHT;
                 }
 
+                // count enemy knights around every empty site in one batch
+                const int nearbyDistance = params.barracksKnightDistance;
+                _siteQueries.clear();
+                for(int emptySiteId : _emptySites)
+                {
+                    const int siteRadius = _state.sites.radius[emptySiteId];
+                    _siteQueries.push(_state.sites.x[emptySiteId], _state.sites.y[emptySiteId], nearbyDistance + siteRadius);
+                }
+                _rangeTargets.clear();
+                for(int knightIdx : _enemyTeam.knights)
+                {
+                    _rangeTargets.push(_state.units.x[knightIdx], _state.units.y[knightIdx], unitRadius(UnitType::KNIGHT));
+                }
+                countInRangeBatch(_siteQueries.x, _siteQueries.y, _siteQueries.radius, _siteQueries.size,
+                                  _rangeTargets.x, _rangeTargets.y, _rangeTargets.radius, _rangeTargets.size,
+                                  _knightsNearSite);
+
                 bool foundSuitableSite = false;
-                for(std::shared_ptr<EmptySite>& emptySitePtr : _emptySites)
+                for(int cntSite = 0; cntSite < _emptySites.size(); ++cntSite)
                 {
-                    constexpr int nearbyDistance = 120;
-                    int numberOfKnightsNearby = getNumberOfUnitsInRange(emptySitePtr, _enemyTeam.knights, nearbyDistance);
-                    int numberOfTowersNearby = getNumberOfUnitsInRange(emptySitePtr, _enemyTeam.towers, 200);
-                    if(numberOfKnightsNearby < 2 && numberOfTowersNearby == 0)
+                    const int emptySiteId = _emptySites[cntSite];
+                    int numberOfKnightsNearby = _knightsNearSite[cntSite];
+                    if(numberOfKnightsNearby < 2 && !_towerCoverage.siteUnderFire(emptySiteId, 1))
                     {
-                        queenBUILD(emptySitePtr->getSiteId(), newBarracksType);
+                        queenBUILD(emptySiteId, newBarracksType);
                         foundSuitableSite = true;
                         break;
                     }
                 }
                 if(!foundSuitableSite)
                 {
-                    queenBUILD(_emptySites.front()->getSiteId(), newBarracksType);
+                    queenBUILD(_emptySites.front(), newBarracksType);
                 }
             }
             measureTime("[TIME]Build barracks evaluation finished -> ");
             if(!_queenOrdered && towersCanBeUpgraded)
             {
+                PROFILE_SCOPE("towers");
                 // sort the friendly towers by distance from the queen
                 DBG_INFO("[STRAT] Sorting friendly towers by distance to our queen...");
-                std::sort(_friendlyTeam.towers.begin(), _friendlyTeam.towers.end(),
-                          [&](const std::shared_ptr<Tower>& a,
-                          const std::shared_ptr<Tower>& b) -> bool
-                {
-                    return _friendlyTeam.queen->distanceTo(*a) < _friendlyTeam.queen->distanceTo(*b);
-                });
-                for(std::shared_ptr<Tower>& towerPtr : _friendlyTeam.towers)
+                sortSitesByQueenDistance(_friendlyTeam.towers);
+                for(int towerId : _friendlyTeam.towers)
                 {
-                    if(towerPtr->getHealth() < towerDesiredHp)
+                    if(SiteSets::contains(_siteSets.weakTowers, towerId))
                     {
-                        queenBUILD(towerPtr->getSiteId(), StructureType::TOWER);
+                        queenBUILD(towerId, StructureType::TOWER);
                         break;
                     }
                 }
             }
             measureTime("[TIME]Upgrade towers evaluation finished -> ");
 
-            if(!_queenOrdered && _friendlyTeam.towers.size() < nbFriendlyTowersMax)
+            if(!_queenOrdered && _friendlyTeam.towers.size() < params.nbFriendlyTowersMax)
             {
-                queenBUILD(_emptySites.front()->getSiteId(), StructureType::TOWER);
+                PROFILE_SCOPE("towers");
+                queenBUILD(_emptySites.front(), StructureType::TOWER);
             }
             measureTime("[TIME]Build towers / go to archers barracks evaluation finished -> ");
-            if(!_queenOrdered && getNumberOfUnitsInRange(_friendlyTeam.queen, _enemyTeam.knights, 60) > 1 && !_friendlyTeam.towers.empty())
+            if(!_queenOrdered && !_friendlyTeam.towers.empty()
+                    && (getNumberOfUnitsInRange(queenPosition(), unitRadius(UnitType::QUEEN), 1, UnitType::KNIGHT, 60) > 1
+                        || _creepForecast.queenDamageWithin(queenPosition(), fleeForecastTurns) > 1))
             {
-                Position towersAvgPos = getAveragePosition(_friendlyTeam.towers);
-
-                queenMOVE(towersAvgPos);
+                queenMOVE(safestRetreat());
             }
         }
         if(!_queenOrdered && !_friendlyTeam.barracksArchers.empty())
         {
             DBG_INFO("[STRAT] We have enough barracks let's avoid those enemy knights");
 
-            queenMOVE(_friendlyTeam.barracksArchers[0]->getPosition());
+            queenMOVE(_state.sitePosition(_friendlyTeam.barracksArchers[0]));
         }
 
         if(!_queenOrdered)
         {
             queenWAIT();
         }
+        measureTime("[TIME] Greedy queen action chosen -> ");
+
+        if(_deadline.mustEmitNow())
+        {
+            DBG_INFO("[DEADLINE] Out of time after the greedy chain - emitting fallback.");
+            emitFallback();
+            return;
+        }
+        _deadline.beginPhase(TurnPhase::SEARCH);
+        if(!fromBook)
+        {
+            PROFILE_SCOPE("search");
+            GameState searchRoot = _state;
+            assumeEnemyGold(searchRoot);
+            _commands.queen = _beamSearch.run(searchRoot, _commands.queen, _deadline.phaseDeadline(),
+                                              _hasPonderedAction ? &_ponderedAction : nullptr);
+            DBG_INFO("[SEARCH] Evaluated " << _beamSearch.getNbEvaluations() << " sequences, completed depth "
+                     << _beamSearch.getCompletedDepth() << ", best score " << _beamSearch.getBestScore()
+                     << ", " << _beamSearch.getNbTranspositions() << " transpositions skipped");
+        }
+        _deadline.beginPhase(TurnPhase::EVALUATE);
+        if(_deadline.mustEmitNow())
+        {
+            DBG_INFO("[DEADLINE] Out of time after the search - emitting without training.");
+            emitFallback();
+            return;
+        }
         measureTime("[TIME] Start training evaluation -> ");
 
 
-        DBG_INFO("[STRAT] Evaluating training opportunities - current gold: " << _gold);
+        DBG_INFO("[STRAT] Evaluating training opportunities - current gold: " << _state.gold[0]);
         {
-            std::vector<int> barracksToTrain;
-            barracksToTrain.reserve(_friendlyTeam.barracksArchers.size()+_friendlyTeam.barracksKnights.size()+_friendlyTeam.barracksGiants.size());
-
-            if(_gold > priceOfKnights)
+            PROFILE_SCOPE("training");
+            if(_state.gold[0] > priceOfKnights)
             {
                 DBG_INFO("[STRAT] We have at least 80 gold - we can train units");
 
@@ -887,17 +6133,17 @@ public:
                     if(!_friendlyTeam.barracksArchers.empty())
                     {
                         DBG_INFO("[STRAT] We have archer barracks");
-                        if(_gold > priceOfArchers)
+                        if(_state.gold[0] > priceOfArchers)
                         {
                             DBG_INFO("[STRAT] We have enough money for archers");
-                            if(_friendlyTeam.barracksArchers[0]->getTurnsUntilTrain() > 0)
+                            if(!SiteSets::contains(_siteSets.readyBarracks, _friendlyTeam.barracksArchers[0]))
                             {
-                                DBG_INFO("[STRAT] We have to wait to train archers for " << _friendlyTeam.barracksArchers[0]->getTurnsUntilTrain() << " more turns.");
+                                DBG_INFO("[STRAT] We have to wait to train archers for " << _state.sites.param1[_friendlyTeam.barracksArchers[0]] << " more turns.");
                             }
                             else
                             {
-                                barracksToTrain.emplace_back(_friendlyTeam.barracksArchers[0]->getSiteId());
-                                _gold -= priceOfArchers;
+                                barracksTRAIN(_friendlyTeam.barracksArchers[0]);
+                                _state.gold[0] -= priceOfArchers;
                             }
                         }
                     }
@@ -909,101 +6155,333 @@ public:
                     if(!_friendlyTeam.barracksGiants.empty())
                     {
                         DBG_INFO("[STRAT] We have giants barracks");
-                        if(_gold < priceOfGiant)
+                        if(_state.gold[0] < priceOfGiant)
                         {
                             DBG_INFO("[STRAT] We have enough money for giants");
-                            if(_friendlyTeam.barracksGiants[0]->getTurnsUntilTrain() > 0)
+                            if(!SiteSets::contains(_siteSets.readyBarracks, _friendlyTeam.barracksGiants[0]))
                             {
-                                DBG_INFO("[STRAT] We have to wait to train giants for " << _friendlyTeam.barracksArchers[0]->getTurnsUntilTrain() << " more turns.");
+                                DBG_INFO("[STRAT] We have to wait to train giants for " << _state.sites.param1[_friendlyTeam.barracksGiants[0]] << " more turns.");
                             }
                             else
                             {
-                                barracksToTrain.emplace_back(_friendlyTeam.barracksGiants[0]->getSiteId());
-                                _gold -= priceOfGiant;
+                                barracksTRAIN(_friendlyTeam.barracksGiants[0]);
+                                _state.gold[0] -= priceOfGiant;
                             }
                         }
                     }
 
                 }
 
-                for(std::shared_ptr<Barracks> currentBarracks : _friendlyTeam.barracksKnights)
+                for(int barracksId : _friendlyTeam.barracksKnights)
                 {
-                    if(_gold < _saveGold)
+                    if(_state.gold[0] < _saveGold)
                     {
                         DBG_INFO("[STRAT] We need money for archers/giants - pause training of knights and try to save.");
                         break;
                     }
-                    if(_gold < priceOfKnights)
+                    if(_state.gold[0] < priceOfKnights)
                     {
                         DBG_INFO("[STRAT] No more money for training knights.");
                         break;
                     }
-                    if(currentBarracks->getTurnsUntilTrain() > 0)
+                    if(!SiteSets::contains(_siteSets.readyBarracks, barracksId))
                     {
-                        DBG_INFO("[STRAT] Barracks(" << currentBarracks->getSiteId() << ") has " << currentBarracks->getTurnsUntilTrain() << " more turns until training is available.");
+                        DBG_INFO("[STRAT] Barracks(" << barracksId << ") has " << _state.sites.param1[barracksId] << " more turns until training is available.");
                         continue;
                     }
 
-                    barracksToTrain.emplace_back(currentBarracks->getSiteId());
-                    _gold -= priceOfKnights;
+                    barracksTRAIN(barracksId);
+                    _state.gold[0] -= priceOfKnights;
                     DBG_INFO("[STRAT] We have money for kingts - lets do this shit!");
                 }
 
             }
+        }
+        routeQueenAction();
+        _deadline.beginPhase(TurnPhase::EMIT);
+        writeCommands();
+    }
 
-            std::cout << "TRAIN";
-            if(!barracksToTrain.empty())
+    // The referee walks the queen in a straight line and lets her slide along any site in the way.
+    // When a site blocks the way, walk to the first waypoint around it instead; BUILD resumes once the way is clear.
+    inline void routeQueenAction()
+    {
+        PROFILE_SCOPE("route");
+        QueenAction& queen = _commands.queen;
+        Position firstStep;
+        if(queen.type == QueenActionType::MOVE)
+        {
+            _pathFinder.setDangerZones(_state);
+            _pathFinder.route(queenPosition(), Position(queen.x, queen.y), firstStep, true);
+            queen.x = firstStep.x;
+            queen.y = firstStep.y;
+        }
+        else if(queen.type == QueenActionType::BUILD && queen.siteId != _state.touchedSite[0])
+        {
+            _pathFinder.routeToSite(queenPosition(), queen.siteId, firstStep, false);
+            if(firstStep != _state.sitePosition(queen.siteId))
             {
-                for(int id : barracksToTrain)
-                {
-                    std::cout << " " << id;
-                }
+                DBG_INFO("[PATH] Site " << queen.siteId << " is behind another one - walking around it");
+                queen = QueenAction::move(firstStep);
+            }
+        }
+    }
+
+    // Sends whatever has been decided so far - WAIT if the queen has no order yet.
+    inline void emitFallback()
+    {
+        _deadline.beginPhase(TurnPhase::EMIT);
+        if(!_queenOrdered)
+        {
+            queenWAIT();
+        }
+        writeCommands();
+    }
+
+    inline bool processOneTurn()
+    {
+        if(!_in.waitForData())
+        {
+            endOfGame();
+            return false;
+        }
+        _ponderer.interrupt();
+        _deadline.startTurn(_currentTurn == 0);
+        {
+            PROFILE_SCOPE("turn");
+            DBG_INFO("Starting turn " << _currentTurn);
+            if(!readTurnInput())
+            {
+                endOfGame();
+                return false;
+            }
+            measureTime("[TIME] Input -> ");
+            collectPondering();
+            if(_recorder.isOpen())
+            {
+                _capturedState = _state;
+            }
+            if(_ponderer.isRunning())
+            {
+                _predictedState = _state;
+            }
+            decideTurn();
+            _recorder.writeTurn(_capturedState, _commands, _deadline);
+        }
+        ponderNextTurn();
+        flushDebugLog();
+        // The referee may stop the process without closing stdin, so the last turn reports on its own.
+        if(_currentTurn >= MAX_TURNS)
+        {
+            endOfGame();
+        }
+        return true;
+    }
+
+    // Plays a turn whose input was parsed elsewhere - replays and in-process matches.
+    inline bool playTurn(const GameState& parsed)
+    {
+        _currentTurn = parsed.turn;
+        _deadline.startTurn(_currentTurn == 0);
+        _state = parsed;
+        _siteSets.clear();
+        for(int siteId = 0; siteId < _state.numSites; ++siteId)
+        {
+            _siteSets.classify(_state.sites, siteId, _params.towerDesiredHp);
+        }
+        indexTeams();
+        if(_friendlyTeam.queen < 0)
+        {
+            return false;
+        }
+        {
+            PROFILE_SCOPE("turn");
+            decideTurn();
+        }
+        flushDebugLog();
+        return true;
+    }
+
+    // Dumps the match-long profile once, when the input ends or the last turn is played.
+    inline void endOfGame()
+    {
+        if(_gameEnded)
+        {
+            return;
+        }
+        _gameEnded = true;
+#ifdef PROFILE_TURNS
+        Profiler::instance().report();
+#endif
+        flushDebugLog();
+    }
+
+    // Formats the turn's debug records - only once its commands are out.
+    inline void flushDebugLog()
+    {
+#if defined(PRINT_DEBUG_INFO) || defined(PRINT_DEBUG_INPUT)
+        DebugLog::instance().drain(STDERR_FILENO);
+#endif
+    }
+
+private:
+    // The enemy's gold is hidden - the search starts from the opponent model's estimate.
+    inline void assumeEnemyGold(GameState& root) const
+    {
+        root.gold[1] = _opponent.estimatedGold();
+    }
+
+    // Predicts the next turn by stepping this turn's input with the commands just sent - the enemy queen
+    // holding still - and hands it to the worker until the real input arrives. Nothing to search while the opening book plays.
+    inline void ponderNextTurn()
+    {
+        if(!_ponderer.isRunning() || _currentTurn >= MAX_TURNS || _openingBook.isPlaying())
+        {
+            return;
+        }
+        PlayerCommands commands[2];
+        commands[0] = _commands;
+        Simulator::step(_predictedState, commands);
+        if(Simulator::isGameOver(_predictedState))
+        {
+            return;
+        }
+        assumeEnemyGold(_predictedState);
+        _ponderJob.predicted = _predictedState;
+        _ponderJob.fallback = _commands.queen;
+        _ponderJob.turn = _currentTurn;
+        _ponderer.submit(_ponderJob);
+    }
+
+    // The pondered action is kept when the structures are the ones predicted and our queen is where she was
+    // expected - creeps and the enemy queen are allowed to differ.
+    inline bool predictionIsClose() const
+    {
+        constexpr int maxQueenDrift = 30;
+        for(int siteId = 0; siteId < _state.numSites; ++siteId)
+        {
+            if(_state.sites.owner[siteId] != _predictedState.sites.owner[siteId]
+                    || _state.sites.type[siteId] != _predictedState.sites.type[siteId])
+            {
+                return false;
             }
-            std::cout << std::endl;
         }
+        int queens[2];
+        Simulator::findQueens(_predictedState, queens);
+        if(queens[0] < 0)
+        {
+            return false;
+        }
+        return distanceBetween(queenPosition(), 0, _predictedState.unitPosition(queens[0]), 0) <= maxQueenDrift;
     }
 
-    inline void processOneTurn()
+    inline void collectPondering()
     {
-        DBG_INFO("Starting turn " << _currentTurn);
-        _startTurn = std::chrono::high_resolution_clock::now();
-        readTurnInput();
-        measureTime("[TIME] Input -> ");
-        if(_currentTurn == 0)
+        _hasPonderedAction = false;
+        Ponderer::Result result;
+        if(!_ponderer.collect(result) || result.turn != _currentTurn)
         {
-            _queenStartingHp = _friendlyTeam.queen->getHealth();
-            _queenStartPosition = _friendlyTeam.queen->getPosition();
+            return;
+        }
+        _hasPonderedAction = predictionIsClose();
+        if(_hasPonderedAction)
+        {
+            _ponderedAction = result.best;
+        }
+        DBG_INFO("[PONDER] " << result.nbEvaluations << " sequences to depth " << result.completedDepth
+                 << " between turns - prediction " << (_hasPonderedAction ? "kept" : "dropped"));
+    }
+
+    inline void decideTurn()
+    {
+        _deadline.beginPhase(TurnPhase::EVALUATE);
+        _opponent.observe(_state);
+        if(_queenStartingHp == 0)
+        {
+            _queenStartingHp = _state.units.hp[_friendlyTeam.queen];
+            _queenStartPosition = queenPosition();
+            _openingBook.select(_state, _queenStartPosition);
+        }
+        if(_deadline.mustEmitNow())
+        {
+            DBG_INFO("[DEADLINE] Out of time after parsing - emitting fallback.");
+            _queenOrdered = false;
+            _commands = PlayerCommands();
+            emitFallback();
+        }
+        else
+        {
+            PROFILE_SCOPE("strategy");
+            takeAction();
         }
-        takeAction();
         measureTime("[TIME] End of turn -> ");
+        DBG_INFO("[DEADLINE] parse " << _deadline.phaseElapsed(TurnPhase::PARSE).count()
+                 << "us, evaluate " << _deadline.phaseElapsed(TurnPhase::EVALUATE).count()
+                 << "us, search " << _deadline.phaseElapsed(TurnPhase::SEARCH).count() << "us");
         ++_currentTurn;
     }
 
 
-private:
-    SiteInfoMap _sInfo;
-    int _gold;
-    int _touchedSite;
-    std::vector<std::shared_ptr<EmptySite>> _emptySites;
+    InputReader _in;
+    OutputWriter _out;
+    GameState _state;
+    SiteList _emptySites;
+    PlayerCommands _commands;
+    BeamSearch _beamSearch;
     TeamState _friendlyTeam;
     TeamState _enemyTeam;
     int _currentTurn;
     bool _queenOrdered;
+    bool _gameEnded;
+    bool _hasPreviousTurn;
+    StrategyParams _params;
     int _saveGold;
     int _queenStartingHp;
     Position _queenStartPosition;
-    std::chrono::high_resolution_clock::time_point _startTurn;
-    std::chrono::high_resolution_clock::time_point _measurePoint;
+    TurnDeadline _deadline;
+    UnitGrid _unitGrid;
+    SiteGrid _siteGrid;
+    int _maxSiteRadius;
+    OpeningBook _openingBook;
+    TowerCoverage _towerCoverage;
+    TourPlanner _tourPlanner;
+    OpponentModel _opponent;
+    SiteDistanceTable _siteTable;
+    PathFinder _pathFinder;
+    int _queenSiteDistance[MAX_SITES];
+    int _queenUnitDistanceSq[MAX_UNITS];
+    PointBatch<MAX_SITES> _siteQueries;
+    PointBatch<MAX_UNITS> _rangeTargets;
+    alignas(32) int _knightsNearSite[MAX_SITES];
+    MatchRecorder _recorder;
+    GameState _capturedState;
+    Ponderer _ponderer;
+    Ponderer::Job _ponderJob;
+    GameState _predictedState;
+    QueenAction _ponderedAction;
+    bool _hasPonderedAction;
+    TurnChanges _changes;
+    SiteSets _siteSets;
+    CreepForecast _creepForecast;
+    GameState::Sites _previousSites;
+    int _previousUnitCount[2][4];
+    Position _previousQueenPosition;
 };
 
+#ifndef CODEROYALE_NO_MAIN
 int main()
 {
     GameContext game;
+    if(const char* capturePath = std::getenv("CODEROYALE_RECORD"))
+    {
+        game.startRecording(capturePath);
+    }
     game.readInit();
+    game.enablePondering();
 
     // game loop
-    while (1)
+    while (game.processOneTurn())
     {
-        game.processOneTurn();
     }
 }
+#endif
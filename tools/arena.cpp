@@ -0,0 +1,142 @@
+#include "match.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options] [agentA] [agentB]\n"
+                 "  Plays headless matches of agentA against agentB (default: bot against greedy).\n"
+                 "  Agents: bot, bot:N (N search evaluations per turn), greedy (no search).\n"
+                 "  --games N         matches to play, sides swapped on every other one (default 200)\n"
+                 "  --threads N       worker threads (default: all cores)\n"
+                 "  --seed N          first map seed (default 1)\n"
+                 "  --search-evals N  evaluations per turn for plain \"bot\", -1 for the turn clock (default 200)\n",
+                 program);
+}
+
+struct ArenaTally
+{
+    int wins = 0;
+    int losses = 0;
+    int draws = 0;
+    long turns = 0;
+    double scoreSum = 0.0;
+    double scoreSquares = 0.0;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    int nbGames = 200;
+    int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t firstSeed = 1;
+    int searchEvaluations = 200;
+    std::vector<std::string> specs;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        const bool hasValue = arg + 1 < argc;
+        if(option == "--games" && hasValue)
+        {
+            nbGames = std::atoi(argv[++arg]);
+        }
+        else if(option == "--threads" && hasValue)
+        {
+            nbThreads = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--seed" && hasValue)
+        {
+            firstSeed = std::strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(option == "--search-evals" && hasValue)
+        {
+            searchEvaluations = std::atoi(argv[++arg]);
+        }
+        else if(option == "-h" || option == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            specs.emplace_back(option);
+        }
+    }
+    if(specs.empty())
+    {
+        specs.emplace_back("bot");
+    }
+    if(specs.size() == 1)
+    {
+        specs.emplace_back("greedy");
+    }
+    if(specs.size() != 2 || !makeAgent(specs[0], 0) || !makeAgent(specs[1], 0))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::atomic<int> nextGame(0);
+    std::mutex tallyMutex;
+    ArenaTally tally;
+    auto worker = [&]()
+    {
+        std::unique_ptr<Agent> agentA = makeAgent(specs[0], searchEvaluations);
+        std::unique_ptr<Agent> agentB = makeAgent(specs[1], searchEvaluations);
+        for(int game = nextGame++; game < nbGames; game = nextGame++)
+        {
+            // Each map is played twice with the sides swapped to cancel out the first player advantage.
+            const uint64_t seed = firstSeed + game / 2;
+            const bool swapped = game % 2 == 1;
+            const MatchResult result = swapped ? playMatch(seed, *agentB, *agentA) : playMatch(seed, *agentA, *agentB);
+            const int sideA = swapped ? 1 : 0;
+            const double score = result.winner < 0 ? 0.5 : (result.winner == sideA ? 1.0 : 0.0);
+
+            std::lock_guard<std::mutex> lock(tallyMutex);
+            tally.wins += score == 1.0;
+            tally.losses += score == 0.0;
+            tally.draws += score == 0.5;
+            tally.turns += result.turns;
+            tally.scoreSum += score;
+            tally.scoreSquares += score * score;
+        }
+    };
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int thread = 0; thread < std::min(nbThreads, nbGames); ++thread)
+    {
+        threads.emplace_back(worker);
+    }
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const int played = tally.wins + tally.losses + tally.draws;
+    if(played == 0)
+    {
+        return 1;
+    }
+    const double mean = tally.scoreSum / played;
+    const double variance = std::max(0.0, tally.scoreSquares / played - mean * mean);
+    const double margin = 1.96 * std::sqrt(variance / played);
+    std::printf("%s vs %s: %d games, +%d -%d =%d\n", specs[0].c_str(), specs[1].c_str(), played, tally.wins, tally.losses, tally.draws);
+    std::printf("score %.1f%% +- %.1f%% (95%% CI), average length %.1f turns\n",
+                100.0 * mean, 100.0 * margin, static_cast<double>(tally.turns) / played);
+    std::printf("%d threads, %.2f s, %.2f games/s\n", static_cast<int>(threads.size()), seconds, played / seconds);
+    return 0;
+}
@@ -0,0 +1,366 @@
+#include "capture.h"
+#include "match.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every heap allocation of the process goes through these, so a benchmark can report allocations per operation.
+static std::atomic<long> g_allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++g_allocations;
+    if(void* memory = std::malloc(size ? size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+namespace
+{
+
+template<typename T>
+inline void keepAlive(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct BenchOptions
+{
+    double minSeconds = 0.2;
+    bool json = false;
+    std::string filter;
+};
+
+// Calls op until minSeconds have passed; each call counts as opsPerCall operations. setup runs before every
+// call, outside the timed region and the allocation count.
+void runBenchmark(const BenchOptions& options, const std::string& name, long opsPerCall, const std::function<void()>& setup, const std::function<void()>& op)
+{
+    if(!options.filter.empty() && name.find(options.filter) == std::string::npos)
+    {
+        return;
+    }
+    setup();
+    op();  // warm-up
+
+    long calls = 0;
+    long allocations = 0;
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+    const std::chrono::duration<double> minDuration(options.minSeconds);
+    while(elapsed < minDuration)
+    {
+        setup();
+        const long allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        op();
+        elapsed += std::chrono::steady_clock::now() - start;
+        allocations += g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+        ++calls;
+    }
+
+    const double ops = static_cast<double>(calls) * opsPerCall;
+    const double nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+    const double allocationsPerOp = allocations / ops;
+    if(options.json)
+    {
+        std::printf("{\"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"ops\": %.0f}\n",
+                    name.c_str(), nsPerOp, allocationsPerOp, ops);
+    }
+    else
+    {
+        std::printf("%-36s %14.1f ns/op %10.3f allocs/op %12.0f ops\n", name.c_str(), nsPerOp, allocationsPerOp, ops);
+    }
+}
+
+void runBenchmark(const BenchOptions& options, const std::string& name, long opsPerCall, const std::function<void()>& op)
+{
+    runBenchmark(options, name, opsPerCall, []() {}, op);
+}
+
+int protocolStructureType(StructureType sType)
+{
+    switch (sType)
+    {
+        case StructureType::MINE:
+            return 0;
+        case StructureType::TOWER:
+            return 1;
+        case StructureType::BARRACKS_KNIGHT:
+        case StructureType::BARRACKS_ARCHER:
+        case StructureType::BARRACKS_GIANT:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+int protocolParam2(const GameState& state, int siteId)
+{
+    switch (state.sites.type[siteId])
+    {
+        case StructureType::BARRACKS_KNIGHT:
+            return 0;
+        case StructureType::BARRACKS_ARCHER:
+            return 1;
+        case StructureType::BARRACKS_GIANT:
+            return 2;
+        default:
+            return state.sites.param2[siteId];
+    }
+}
+
+// The referee's text protocol for a sequence of player views, as the bot reads it on stdin.
+std::string encodeInputStream(const std::vector<GameState>& views)
+{
+    std::string retVal;
+    char line[128];
+    const GameState& layout = views.front();
+    retVal += std::to_string(layout.numSites) + '\n';
+    for(int siteId = 0; siteId < layout.numSites; ++siteId)
+    {
+        std::snprintf(line, sizeof(line), "%d %d %d %d\n", siteId, layout.sites.x[siteId], layout.sites.y[siteId], layout.sites.radius[siteId]);
+        retVal += line;
+    }
+    for(const GameState& view : views)
+    {
+        std::snprintf(line, sizeof(line), "%d %d\n", view.gold[0], view.touchedSite[0]);
+        retVal += line;
+        for(int siteId = 0; siteId < view.numSites; ++siteId)
+        {
+            std::snprintf(line, sizeof(line), "%d %d %d %d %d %d %d\n", siteId, view.sites.gold[siteId], view.sites.maxMineSize[siteId],
+                          protocolStructureType(view.sites.type[siteId]), view.sites.owner[siteId],
+                          view.sites.param1[siteId], protocolParam2(view, siteId));
+            retVal += line;
+        }
+        retVal += std::to_string(view.numUnits) + '\n';
+        for(int unitIdx = 0; unitIdx < view.numUnits; ++unitIdx)
+        {
+            const int uType = view.units.type[unitIdx] == UnitType::QUEEN ? -1 : static_cast<int>(view.units.type[unitIdx]);
+            std::snprintf(line, sizeof(line), "%d %d %d %d %d\n", view.units.x[unitIdx], view.units.y[unitIdx],
+                          view.units.owner[unitIdx], uType, view.units.hp[unitIdx]);
+            retVal += line;
+        }
+    }
+    return retVal;
+}
+
+// Player 0's view of every turn of a deterministic self-play match.
+std::vector<GameState> recordSelfPlay(uint64_t seed)
+{
+    std::vector<GameState> retVal;
+    BotAgent players[2] = {BotAgent(200), BotAgent(0)};
+    GameState state = generateMatch(seed);
+    GameState view;
+    for(BotAgent& player : players)
+    {
+        player.startMatch(state);
+    }
+    PlayerCommands commands[2];
+    while(!Simulator::isGameOver(state))
+    {
+        for(int player = 0; player < 2; ++player)
+        {
+            playerView(state, player, view);
+            if(player == 0)
+            {
+                retVal.push_back(view);
+            }
+            commands[player] = PlayerCommands();
+            players[player].playTurn(view, commands[player]);
+        }
+        Simulator::step(state, commands);
+    }
+    return retVal;
+}
+
+std::vector<GameState> loadCapture(const std::string& path)
+{
+    std::vector<GameState> retVal;
+    CaptureFile capture;
+    if(!capture.open(path))
+    {
+        return retVal;
+    }
+    CaptureTurn turn;
+    while(capture.nextTurn(turn))
+    {
+        retVal.push_back(turn.state);
+    }
+    return retVal;
+}
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [--json] [--filter TEXT] [--min-time SECONDS] [--seed N] [--capture FILE]\n"
+                 "  Fixtures come from a seeded self-play match, or from a capture written with CODEROYALE_RECORD.\n",
+                 program);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    uint64_t seed = 1;
+    std::string capturePath;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        const bool hasValue = arg + 1 < argc;
+        if(option == "--json")
+        {
+            options.json = true;
+        }
+        else if(option == "--filter" && hasValue)
+        {
+            options.filter = argv[++arg];
+        }
+        else if(option == "--min-time" && hasValue)
+        {
+            options.minSeconds = std::atof(argv[++arg]);
+        }
+        else if(option == "--seed" && hasValue)
+        {
+            seed = std::strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(option == "--capture" && hasValue)
+        {
+            capturePath = argv[++arg];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return option == "-h" || option == "--help" ? 0 : 1;
+        }
+    }
+
+    const std::vector<GameState> views = capturePath.empty() ? recordSelfPlay(seed) : loadCapture(capturePath);
+    if(views.size() < 3)
+    {
+        std::fprintf(stderr, "not enough turns to build fixtures\n");
+        return 1;
+    }
+    const long nbTurns = static_cast<long>(views.size());
+
+    // Input parsing: the whole game as text, read back through a pipe-like file descriptor.
+    const std::string input = encodeInputStream(views);
+    FILE* inputFile = std::tmpfile();
+    std::fwrite(input.data(), 1, input.size(), inputFile);
+    std::fflush(inputFile);
+    const int inputFd = fileno(inputFile);
+    std::unique_ptr<GameContext> reader(new GameContext(inputFd, -1));
+    // A fresh context per pass, its construction and the site tables built by readInit left out of the timing.
+    runBenchmark(options, "readTurnInput", nbTurns, [&]()
+    {
+        ::lseek(inputFd, 0, SEEK_SET);
+        reader.reset(new GameContext(inputFd, -1));
+        reader->readInit();
+    }, [&]()
+    {
+        for(long turn = 0; turn < nbTurns; ++turn)
+        {
+            reader->readTurnInput();
+        }
+    });
+    reader.reset();
+    std::fclose(inputFile);
+
+    // Decision making on early, mid and late game fixtures, with and without the search.
+    const struct { const char* name; size_t turn; } fixtures[] =
+    {
+        {"early", std::min<size_t>(10, views.size() - 1)},
+        {"mid", views.size() / 2},
+        {"late", views.size() - 1},
+    };
+    for(const auto& fixture : fixtures)
+    {
+        const GameState& view = views[fixture.turn];
+        for(int evaluations : {0, 200})
+        {
+            GameContext game(-1, -1);
+            game.setSearchEvaluationLimit(evaluations);
+            game.loadSites(view);
+            const std::string name = std::string("takeAction/") + fixture.name + (evaluations ? "/search200" : "/greedy");
+            runBenchmark(options, name, 1, [&]()
+            {
+                game.playTurn(view);
+            });
+        }
+    }
+
+    // Primitives, on the mid game fixture.
+    const GameState& midView = views[views.size() / 2];
+    GameContext game(-1, -1);
+    game.setSearchEvaluationLimit(0);
+    game.loadSites(midView);
+    game.playTurn(midView);
+
+    constexpr int nbPoints = 1024;
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    std::vector<Position> points(nbPoints);
+    for(Position& point : points)
+    {
+        point.x = std::uniform_int_distribution<int>(0, WORLD_WIDTH)(rng);
+        point.y = std::uniform_int_distribution<int>(0, WORLD_HEIGHT)(rng);
+    }
+    runBenchmark(options, "distanceBetween", nbPoints - 1, [&]()
+    {
+        int sum = 0;
+        for(int pointIdx = 1; pointIdx < nbPoints; ++pointIdx)
+        {
+            sum += distanceBetween(points[pointIdx - 1], QUEEN_RADIUS, points[pointIdx], 0);
+        }
+        keepAlive(sum);
+    });
+    runBenchmark(options, "getNumberOfUnitsInRange", nbPoints, [&]()
+    {
+        int sum = 0;
+        for(const Position& point : points)
+        {
+            sum += game.getNumberOfUnitsInRange(point, 0, 1, UnitType::KNIGHT, 200);
+        }
+        keepAlive(sum);
+    });
+
+    game.computeQueenDistanceKeys();
+    SiteList allSites;
+    for(int siteId = 0; siteId < midView.numSites; ++siteId)
+    {
+        allSites.push(siteId);
+    }
+    const struct { const char* name; const SiteList* sites; } siteSorts[] =
+    {
+        {"sort/emptySites", &game.getEmptySites()},
+        {"sort/mines", &game.getFriendlyTeam().mines},
+        {"sort/towers", &game.getFriendlyTeam().towers},
+        {"sort/allSites", &allSites},
+    };
+    for(const auto& sort : siteSorts)
+    {
+        SiteList sites;
+        runBenchmark(options, sort.name, 1, [&]()
+        {
+            sites = *sort.sites;
+            game.sortSitesByQueenDistance(sites);
+            keepAlive(sites);
+        });
+    }
+    UnitList knights;
+    runBenchmark(options, "sort/enemyKnights", 1, [&]()
+    {
+        knights = game.getEnemyTeam().knights;
+        game.sortKnightsByQueenDistance(knights);
+        keepAlive(knights);
+    });
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// The bot stays a single translation unit so it can be submitted as is.
+// Tools compile it in without its main() and, unless asked otherwise, without the debug chatter.
+#define CODEROYALE_NO_MAIN
+#ifndef CODEROYALE_VERBOSE
+#define CODEROYALE_QUIET
+#endif
+#include "../coderoyale.cpp"
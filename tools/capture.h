@@ -0,0 +1,196 @@
+#pragma once
+
+#include "bot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct CaptureTurn
+{
+    GameState state;
+    PlayerCommands commands;
+    uint32_t phaseMicros[TurnDeadline::nbPhases];
+};
+
+inline bool operator==(const PlayerCommands& a, const PlayerCommands& b)
+{
+    return a.queen == b.queen && a.trainMask == b.trainMask;
+}
+
+// Read-only view of a capture written by MatchRecorder, mapped into memory.
+class CaptureFile
+{
+public:
+    CaptureFile() : _data(nullptr), _size(0), _firstTurn(0), _offset(0)
+    {
+        std::memset(&_layout, 0, sizeof(_layout));
+    }
+    ~CaptureFile() { close(); }
+
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if(::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(CaptureFileHeader)))
+        {
+            ::close(fd);
+            return false;
+        }
+        void* mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        _data = static_cast<const char*>(mapping);
+        _size = static_cast<size_t>(info.st_size);
+
+        CaptureFileHeader header;
+        std::memcpy(&header, _data, sizeof(header));
+        const size_t layoutEnd = sizeof(header) + header.numSites * sizeof(CaptureSite);
+        if(std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0
+                || header.version != CAPTURE_VERSION
+                || header.numSites > MAX_SITES
+                || layoutEnd > _size)
+        {
+            close();
+            return false;
+        }
+
+        std::memset(&_layout, 0, sizeof(_layout));
+        _layout.numSites = header.numSites;
+        for(int siteId = 0; siteId < header.numSites; ++siteId)
+        {
+            CaptureSite site;
+            std::memcpy(&site, _data + sizeof(header) + siteId * sizeof(CaptureSite), sizeof(site));
+            _layout.sites.x[siteId] = site.x;
+            _layout.sites.y[siteId] = site.y;
+            _layout.sites.radius[siteId] = site.radius;
+        }
+        _firstTurn = layoutEnd;
+        _offset = layoutEnd;
+        return true;
+    }
+
+    void close()
+    {
+        if(_data)
+        {
+            ::munmap(const_cast<char*>(_data), _size);
+            _data = nullptr;
+            _size = 0;
+        }
+    }
+
+    inline const GameState& layout() const { return _layout; }
+    inline void rewind() { _offset = _firstTurn; }
+
+    // Decodes the next turn record. Returns false at the end of the file or on a truncated record.
+    bool nextTurn(CaptureTurn& turn)
+    {
+        if(!_data || _offset + sizeof(CaptureTurnHeader) > _size)
+        {
+            return false;
+        }
+        CaptureTurnHeader header;
+        std::memcpy(&header, _data + _offset, sizeof(header));
+        const size_t expectedSize = sizeof(header) + _layout.numSites * sizeof(CaptureSiteState) + header.numUnits * sizeof(CaptureUnit);
+        if(header.recordSize != expectedSize || _offset + expectedSize > _size || header.numUnits > MAX_UNITS)
+        {
+            return false;
+        }
+
+        GameState& state = turn.state;
+        state = _layout;
+        state.turn = header.turn;
+        state.gold[0] = header.gold;
+        state.gold[1] = 0;
+        state.touchedSite[0] = header.touchedSite;
+        state.touchedSite[1] = -1;
+        state.numUnits = header.numUnits;
+
+        const char* cursor = _data + _offset + sizeof(header);
+        for(int siteId = 0; siteId < _layout.numSites; ++siteId, cursor += sizeof(CaptureSiteState))
+        {
+            CaptureSiteState site;
+            std::memcpy(&site, cursor, sizeof(site));
+            state.sites.gold[siteId] = site.gold;
+            state.sites.maxMineSize[siteId] = site.maxMineSize;
+            state.sites.type[siteId] = static_cast<StructureType>(site.type);
+            state.sites.owner[siteId] = site.owner;
+            state.sites.param1[siteId] = site.param1;
+            state.sites.param2[siteId] = site.param2;
+        }
+        for(int unitIdx = 0; unitIdx < header.numUnits; ++unitIdx, cursor += sizeof(CaptureUnit))
+        {
+            CaptureUnit unit;
+            std::memcpy(&unit, cursor, sizeof(unit));
+            state.units.x[unitIdx] = unit.x;
+            state.units.y[unitIdx] = unit.y;
+            state.units.owner[unitIdx] = unit.owner;
+            state.units.type[unitIdx] = static_cast<UnitType>(unit.type);
+            state.units.hp[unitIdx] = unit.hp;
+        }
+
+        QueenAction& queen = turn.commands.queen;
+        queen = QueenAction();
+        queen.type = static_cast<QueenActionType>(header.commands.queenAction);
+        queen.x = header.commands.x;
+        queen.y = header.commands.y;
+        queen.siteId = header.commands.siteId;
+        queen.sType = static_cast<StructureType>(header.commands.sType);
+        turn.commands.trainMask = header.commands.trainMask;
+        std::memcpy(turn.phaseMicros, header.phaseMicros, sizeof(turn.phaseMicros));
+
+        _offset += expectedSize;
+        return true;
+    }
+
+private:
+    const char* _data;
+    size_t _size;
+    size_t _firstTurn;
+    size_t _offset;
+    GameState _layout;
+};
+
+// Expands directories into the capture files they contain, sorted so runs are reproducible.
+inline std::vector<std::string> collectCaptureFiles(const std::vector<std::string>& paths)
+{
+    std::vector<std::string> retVal;
+    for(const std::string& path : paths)
+    {
+        std::error_code error;
+        if(std::filesystem::is_directory(path, error))
+        {
+            std::vector<std::string> found;
+            for(const auto& entry : std::filesystem::recursive_directory_iterator(path, error))
+            {
+                if(entry.is_regular_file() && entry.path().extension() == ".crlog")
+                {
+                    found.emplace_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            retVal.insert(retVal.end(), found.begin(), found.end());
+        }
+        else
+        {
+            retVal.emplace_back(path);
+        }
+    }
+    return retVal;
+}
@@ -0,0 +1,331 @@
+#include "match.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct CheckOptions
+{
+    int games = 20;
+    uint64_t seed = 1;
+    int rolloutTurns = 12;
+};
+
+struct CheckTally
+{
+    long checked = 0;
+    long mismatches = 0;
+};
+
+// Every turn of a greedy self-play match, as the referee sees it.
+std::vector<GameState> recordMatch(uint64_t seed)
+{
+    std::vector<GameState> retVal;
+    BotAgent players[2] = {BotAgent(0), BotAgent(0)};
+    GameState state = generateMatch(seed);
+    GameState view;
+    for(BotAgent& player : players)
+    {
+        player.startMatch(state);
+    }
+    PlayerCommands commands[2];
+    while(!Simulator::isGameOver(state))
+    {
+        retVal.push_back(state);
+        for(int player = 0; player < 2; ++player)
+        {
+            playerView(state, player, view);
+            commands[player] = PlayerCommands();
+            players[player].playTurn(view, commands[player]);
+        }
+        Simulator::step(state, commands);
+    }
+    return retVal;
+}
+
+// Orders of every kind, builds most often since they exercise the most rules.
+PlayerCommands randomCommands(const GameState& state, std::mt19937& rng)
+{
+    PlayerCommands retVal;
+    retVal.trainMask = static_cast<uint32_t>(rng());
+    const int roll = static_cast<int>(rng() % 4);
+    if(roll == 0)
+    {
+        retVal.queen = QueenAction::wait();
+    }
+    else if(roll == 1)
+    {
+        retVal.queen = QueenAction::move(Position(static_cast<int>(rng() % WORLD_WIDTH), static_cast<int>(rng() % WORLD_HEIGHT)));
+    }
+    else
+    {
+        const StructureType sType = static_cast<StructureType>(1 + rng() % 5);
+        retVal.queen = QueenAction::build(static_cast<int>(rng() % state.numSites), sType);
+    }
+    return retVal;
+}
+
+// The first field the two states disagree on, null when they match.
+const char* firstDifference(const GameState& a, const GameState& b)
+{
+    if(a.turn != b.turn)
+    {
+        return "turn";
+    }
+    for(int owner = 0; owner < 2; ++owner)
+    {
+        if(a.gold[owner] != b.gold[owner])
+        {
+            return "gold";
+        }
+        if(a.touchedSite[owner] != b.touchedSite[owner])
+        {
+            return "touchedSite";
+        }
+    }
+    for(int siteId = 0; siteId < a.numSites; ++siteId)
+    {
+        if(a.sites.gold[siteId] != b.sites.gold[siteId])
+        {
+            return "site gold";
+        }
+        if(a.sites.type[siteId] != b.sites.type[siteId] || a.sites.owner[siteId] != b.sites.owner[siteId])
+        {
+            return "site structure";
+        }
+        if(a.sites.param1[siteId] != b.sites.param1[siteId] || a.sites.param2[siteId] != b.sites.param2[siteId])
+        {
+            return "site params";
+        }
+    }
+    if(a.numUnits != b.numUnits)
+    {
+        return "unit count";
+    }
+    for(int unitIdx = 0; unitIdx < a.numUnits; ++unitIdx)
+    {
+        if(a.units.x[unitIdx] != b.units.x[unitIdx] || a.units.y[unitIdx] != b.units.y[unitIdx])
+        {
+            return "unit position";
+        }
+        if(a.units.owner[unitIdx] != b.units.owner[unitIdx] || a.units.type[unitIdx] != b.units.type[unitIdx])
+        {
+            return "unit identity";
+        }
+        if(a.units.hp[unitIdx] != b.units.hp[unitIdx])
+        {
+            return "unit hp";
+        }
+    }
+    return nullptr;
+}
+
+// BatchSimulator must follow Simulator::step exactly: lanes start on recorded turns and play random commands,
+// each compared with the same commands stepped one state at a time.
+void checkBatchSimulator(const std::vector<GameState>& match, uint64_t seed, const CheckOptions& options, CheckTally& tally)
+{
+    constexpr int lanes = BatchSimulator::lanes;
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    BatchSimulator batch;
+    batch.reset(match.front());
+    GameState expected[lanes];
+    GameState actual;
+    PlayerCommands commands[lanes][2];
+    for(size_t first = 0; first < match.size(); first += lanes)
+    {
+        for(int lane = 0; lane < lanes; ++lane)
+        {
+            expected[lane] = match[std::min(first + lane, match.size() - 1)];
+            batch.load(lane, expected[lane]);
+        }
+        for(int turn = 0; turn < options.rolloutTurns && batch.activeMask() != 0; ++turn)
+        {
+            const uint32_t stepped = batch.activeMask();
+            for(uint32_t mask = stepped; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                commands[lane][0] = randomCommands(expected[lane], rng);
+                commands[lane][1] = randomCommands(expected[lane], rng);
+                Simulator::step(expected[lane], commands[lane]);
+            }
+            batch.step(commands);
+            for(uint32_t mask = stepped; mask != 0; mask &= mask - 1)
+            {
+                const int lane = __builtin_ctz(mask);
+                batch.store(lane, actual);
+                const char* difference = firstDifference(expected[lane], actual);
+                const bool overMismatch = Simulator::isGameOver(expected[lane]) == ((batch.activeMask() >> lane & 1) != 0);
+                ++tally.checked;
+                if(difference || overMismatch)
+                {
+                    if(tally.mismatches++ < 10)
+                    {
+                        std::printf("  batch mismatch: map seed %llu, turn %d, lane %d - %s\n", static_cast<unsigned long long>(seed),
+                                    expected[lane].turn, lane, difference ? difference : "game over");
+                    }
+                    batch.deactivate(lane);
+                }
+            }
+        }
+    }
+}
+
+// Summed completion turns of a visiting order, the quantity TourPlanner minimises.
+int tourCost(const SiteDistanceTable& table, const int* order, int nbTargets, const int* queenTurns, const int* buildTurns)
+{
+    int retVal = 0;
+    int time = 0;
+    for(int cnt = 0; cnt < nbTargets; ++cnt)
+    {
+        const int siteId = order[cnt];
+        time += (cnt == 0 ? queenTurns[siteId] : table.travelTurns[order[cnt - 1]][siteId]) + buildTurns[siteId];
+        retVal += time;
+    }
+    return retVal;
+}
+
+// TourPlanner must find the cheapest order of every permutation. One planner serves every plan of a map, so the
+// kept table is reused when the targets repeat with the queen elsewhere, and rebuilt when a build time changes.
+void checkTourPlanner(const GameState& layout, uint64_t seed, CheckTally& tally)
+{
+    constexpr int nbPlans = 30;
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    SiteDistanceTable table;
+    table.build(layout);
+    TourPlanner planner;
+    std::vector<int> siteIds(layout.numSites);
+    int targets[TourPlanner::maxTargets];
+    int nbTargets = 0;
+    int queenTurns[MAX_SITES];
+    int buildTurns[MAX_SITES];
+    for(int plan = 0; plan < nbPlans; ++plan)
+    {
+        const int roll = static_cast<int>(rng() % 3);
+        if(plan == 0 || roll == 0)
+        {
+            for(int siteId = 0; siteId < layout.numSites; ++siteId)
+            {
+                siteIds[siteId] = siteId;
+            }
+            std::shuffle(siteIds.begin(), siteIds.end(), rng);
+            nbTargets = std::min<int>(2 + rng() % (TourPlanner::maxTargets - 1), layout.numSites);
+            std::copy(siteIds.begin(), siteIds.begin() + nbTargets, targets);
+            for(int cnt = 0; cnt < nbTargets; ++cnt)
+            {
+                buildTurns[targets[cnt]] = 1 + static_cast<int>(rng() % 5);
+            }
+        }
+        else if(roll == 1)
+        {
+            buildTurns[targets[rng() % nbTargets]] = 1 + static_cast<int>(rng() % 5);
+        }
+        std::shuffle(targets, targets + nbTargets, rng);
+        for(int cnt = 0; cnt < nbTargets; ++cnt)
+        {
+            queenTurns[targets[cnt]] = static_cast<int>(rng() % 15);
+        }
+
+        int order[TourPlanner::maxTargets];
+        int planQueenTurns[TourPlanner::maxTargets];
+        int planBuildTurns[TourPlanner::maxTargets];
+        for(int cnt = 0; cnt < nbTargets; ++cnt)
+        {
+            order[cnt] = targets[cnt];
+            planQueenTurns[cnt] = queenTurns[targets[cnt]];
+            planBuildTurns[cnt] = buildTurns[targets[cnt]];
+        }
+        planner.plan(table, order, nbTargets, planQueenTurns, planBuildTurns);
+
+        // every permutation, from the targets in ascending order
+        uint32_t targetMask = 0;
+        uint32_t orderMask = 0;
+        for(int cnt = 0; cnt < nbTargets; ++cnt)
+        {
+            targetMask |= 1u << targets[cnt];
+            orderMask |= 1u << order[cnt];
+        }
+        int permutation[TourPlanner::maxTargets];
+        int nbSorted = 0;
+        for(uint32_t mask = targetMask; mask != 0; mask &= mask - 1)
+        {
+            permutation[nbSorted++] = __builtin_ctz(mask);
+        }
+        int bestCost = std::numeric_limits<int>::max();
+        do
+        {
+            bestCost = std::min(bestCost, tourCost(table, permutation, nbTargets, queenTurns, buildTurns));
+        }
+        while(std::next_permutation(permutation, permutation + nbTargets));
+
+        const bool sameSites = orderMask == targetMask;
+        const int cost = tourCost(table, order, nbTargets, queenTurns, buildTurns);
+        ++tally.checked;
+        if(!sameSites || cost != bestCost)
+        {
+            if(tally.mismatches++ < 10)
+            {
+                std::printf("  tour mismatch: map seed %llu, plan %d, %d sites - %s %d, best %d\n", static_cast<unsigned long long>(seed),
+                            plan, nbTargets, sameSites ? "cost" : "sites changed, cost", cost, bestCost);
+            }
+        }
+    }
+}
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  Cross-checks the bot's fast paths against their reference versions on self-play maps.\n"
+                 "  Exits with 1 on any mismatch.\n"
+                 "  --games N     maps to check (default 20)\n"
+                 "  --seed N      first map seed (default 1)\n"
+                 "  --turns N     random turns played from every recorded turn (default 12)\n",
+                 program);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    CheckOptions options;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        const bool hasValue = arg + 1 < argc;
+        if(option == "--games" && hasValue)
+        {
+            options.games = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--seed" && hasValue)
+        {
+            options.seed = std::strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(option == "--turns" && hasValue)
+        {
+            options.rolloutTurns = std::max(1, std::atoi(argv[++arg]));
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return option == "-h" || option == "--help" ? 0 : 1;
+        }
+    }
+
+    CheckTally batchTally;
+    CheckTally tourTally;
+    for(int game = 0; game < options.games; ++game)
+    {
+        const uint64_t seed = options.seed + game;
+        checkBatchSimulator(recordMatch(seed), seed, options, batchTally);
+        checkTourPlanner(generateMatch(seed), seed, tourTally);
+    }
+    std::printf("batch simulator: %ld lane-steps, %ld mismatches\n", batchTally.checked, batchTally.mismatches);
+    std::printf("tour planner: %ld plans, %ld mismatches\n", tourTally.checked, tourTally.mismatches);
+    return batchTally.mismatches == 0 && tourTally.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "bot.h"
+
+#include <memory>
+#include <random>
+#include <string>
+
+// Referee-like map generation: mirrored site pairs, mirrored queens, equal starting conditions.
+constexpr int ARENA_MIN_SITE_PAIRS = 9;
+constexpr int ARENA_MAX_SITE_PAIRS = 12;
+constexpr int ARENA_MIN_SITE_RADIUS = 60;
+constexpr int ARENA_MAX_SITE_RADIUS = 110;
+constexpr int ARENA_MIN_SITE_GOLD = 200;
+constexpr int ARENA_MAX_SITE_GOLD = 250;
+constexpr int ARENA_MAX_MINE_SIZE = 3;
+constexpr int ARENA_STARTING_GOLD = 100;
+constexpr int ARENA_SITE_GAP = 10;
+
+inline GameState generateMatch(uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    auto uniform = [&rng](int low, int high) { return std::uniform_int_distribution<int>(low, high)(rng); };
+
+    GameState state;
+    std::memset(&state, 0, sizeof(state));
+    GameState::Sites& sites = state.sites;
+
+    const int nbPairs = uniform(ARENA_MIN_SITE_PAIRS, ARENA_MAX_SITE_PAIRS);
+    for(int attempt = 0; attempt < 10000 && state.numSites < 2 * nbPairs; ++attempt)
+    {
+        const int radius = uniform(ARENA_MIN_SITE_RADIUS, ARENA_MAX_SITE_RADIUS);
+        const int x = uniform(radius, WORLD_WIDTH / 2 - radius - ARENA_SITE_GAP);
+        const int y = uniform(radius, WORLD_HEIGHT - radius);
+        bool overlaps = false;
+        for(int siteId = 0; siteId < state.numSites && !overlaps; ++siteId)
+        {
+            const int dx = sites.x[siteId] - x;
+            const int dy = sites.y[siteId] - y;
+            const int minDistance = sites.radius[siteId] + radius + ARENA_SITE_GAP;
+            overlaps = dx * dx + dy * dy < minDistance * minDistance;
+        }
+        if(overlaps)
+        {
+            continue;
+        }
+        const int gold = uniform(ARENA_MIN_SITE_GOLD, ARENA_MAX_SITE_GOLD);
+        const int maxMineSize = uniform(1, ARENA_MAX_MINE_SIZE);
+        for(int mirror = 0; mirror < 2; ++mirror)
+        {
+            const int siteId = state.numSites++;
+            sites.x[siteId] = mirror ? WORLD_WIDTH - x : x;
+            sites.y[siteId] = mirror ? WORLD_HEIGHT - y : y;
+            sites.radius[siteId] = radius;
+            sites.gold[siteId] = gold;
+            sites.maxMineSize[siteId] = maxMineSize;
+            sites.type[siteId] = StructureType::EMPTY_SITE;
+            sites.owner[siteId] = -1;
+            sites.param1[siteId] = -1;
+            sites.param2[siteId] = -1;
+        }
+    }
+
+    const int queenHp = 10 * uniform(10, 20);
+    const int queenX = uniform(QUEEN_RADIUS, WORLD_WIDTH / 4);
+    const int queenY = uniform(QUEEN_RADIUS, WORLD_HEIGHT - QUEEN_RADIUS);
+    for(int owner = 0; owner < 2; ++owner)
+    {
+        const int unitIdx = state.numUnits++;
+        state.units.x[unitIdx] = owner ? WORLD_WIDTH - queenX : queenX;
+        state.units.y[unitIdx] = owner ? WORLD_HEIGHT - queenY : queenY;
+        state.units.owner[unitIdx] = owner;
+        state.units.type[unitIdx] = UnitType::QUEEN;
+        state.units.hp[unitIdx] = queenHp;
+        state.gold[owner] = ARENA_STARTING_GOLD;
+        state.touchedSite[owner] = -1;
+    }
+    return state;
+}
+
+// What a player receives as input: its own entities as owner 0, the opponent as owner 1, no enemy gold.
+inline void playerView(const GameState& state, int player, GameState& view)
+{
+    view = state;
+    view.gold[0] = state.gold[player];
+    view.gold[1] = 0;
+    view.touchedSite[0] = state.touchedSite[player];
+    view.touchedSite[1] = -1;
+    if(player == 0)
+    {
+        return;
+    }
+    for(int siteId = 0; siteId < view.numSites; ++siteId)
+    {
+        if(view.sites.owner[siteId] >= 0)
+        {
+            view.sites.owner[siteId] = 1 - view.sites.owner[siteId];
+        }
+    }
+    for(int unitIdx = 0; unitIdx < view.numUnits; ++unitIdx)
+    {
+        view.units.owner[unitIdx] = 1 - view.units.owner[unitIdx];
+    }
+}
+
+// A player driven in-process: gets the map once, then one view per turn.
+class Agent
+{
+public:
+    virtual ~Agent() {}
+    virtual void startMatch(const GameState& layout) = 0;
+    // Returns false when the agent gives up on the match (no queen in its view).
+    virtual bool playTurn(const GameState& view, PlayerCommands& commands) = 0;
+};
+
+// The bot itself. A non-negative evaluation limit makes the search deterministic and independent of machine load.
+class BotAgent : public Agent
+{
+public:
+    explicit BotAgent(int searchEvaluations, const StrategyParams& params = STRATEGY_PARAMS) :
+        _searchEvaluations(searchEvaluations),
+        _params(params),
+        _forceOpening(false),
+        _opening(nullptr)
+    {
+    }
+
+    // Plays this opening line instead of looking the map up in the book - null plays without any.
+    void setOpening(const OpeningLine* line)
+    {
+        _forceOpening = true;
+        _opening = line;
+    }
+
+    void startMatch(const GameState& layout) override
+    {
+        _game.reset(new GameContext(-1, -1));
+        _game->setSearchEvaluationLimit(_searchEvaluations);
+        _game->setStrategyParams(_params);
+        _game->loadSites(layout);
+        if(_forceOpening)
+        {
+            _game->useOpening(_opening);
+        }
+    }
+
+    bool playTurn(const GameState& view, PlayerCommands& commands) override
+    {
+        if(!_game->playTurn(view))
+        {
+            return false;
+        }
+        commands = _game->getCommands();
+        return true;
+    }
+
+private:
+    int _searchEvaluations;
+    StrategyParams _params;
+    bool _forceOpening;
+    const OpeningLine* _opening;
+    std::unique_ptr<GameContext> _game;
+};
+
+// Agent specs used on command lines: "bot" (time-bound search), "bot:N" (N evaluations per turn), "greedy" (no search).
+inline std::unique_ptr<Agent> makeAgent(const std::string& spec, int defaultEvaluations)
+{
+    if(spec == "bot")
+    {
+        return std::unique_ptr<Agent>(new BotAgent(defaultEvaluations));
+    }
+    if(spec == "greedy")
+    {
+        return std::unique_ptr<Agent>(new BotAgent(0));
+    }
+    if(spec.compare(0, 4, "bot:") == 0)
+    {
+        return std::unique_ptr<Agent>(new BotAgent(std::atoi(spec.c_str() + 4)));
+    }
+    return nullptr;
+}
+
+struct MatchResult
+{
+    int winner;  // 0, 1 or -1 for a draw
+    int turns;
+    int queenHp[2];
+};
+
+inline MatchResult playMatch(const GameState& start, Agent& player0, Agent& player1)
+{
+    Agent* players[2] = {&player0, &player1};
+    GameState state = start;
+    GameState view;
+    for(Agent* player : players)
+    {
+        player->startMatch(state);
+    }
+
+    PlayerCommands commands[2];
+    while(!Simulator::isGameOver(state))
+    {
+        for(int player = 0; player < 2; ++player)
+        {
+            playerView(state, player, view);
+            commands[player] = PlayerCommands();
+            if(!players[player]->playTurn(view, commands[player]))
+            {
+                commands[player] = PlayerCommands();
+            }
+        }
+        Simulator::step(state, commands);
+    }
+
+    MatchResult result;
+    result.winner = Simulator::winner(state);
+    result.turns = state.turn;
+    int queens[2];
+    Simulator::findQueens(state, queens);
+    for(int owner = 0; owner < 2; ++owner)
+    {
+        result.queenHp[owner] = queens[owner] >= 0 ? state.units.hp[queens[owner]] : 0;
+    }
+    return result;
+}
+
+inline MatchResult playMatch(uint64_t seed, Agent& player0, Agent& player1)
+{
+    return playMatch(generateMatch(seed), player0, player1);
+}
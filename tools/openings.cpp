@@ -0,0 +1,357 @@
+#include "capture.h"
+#include "match.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Structures an opening step may build. Giants only pay off against towers, which an opening doesn't meet.
+const StructureType STEP_TYPES[] =
+{
+    StructureType::MINE,
+    StructureType::TOWER,
+    StructureType::BARRACKS_KNIGHT,
+    StructureType::BARRACKS_ARCHER,
+};
+
+struct OpeningOptions
+{
+    int layouts = 20;
+    uint64_t seed = 1;
+    int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    int searchEvaluations = 0;
+    int maxSteps = 6;
+    int candidates = 8;
+    int beamWidth = 3;
+    std::string output = "coderoyale.cpp";
+    std::vector<std::string> captures;
+};
+
+struct ScoredLine
+{
+    OpeningLine line;
+    double score;
+};
+
+struct BookEntry
+{
+    OpeningLine line;
+    double score;
+    double plainScore;
+};
+
+// The line's side against the plain bot, from both seats: 1 for a win, 0.5 for a draw, queen hp breaking ties.
+double scoreLine(const GameState& start, const OpeningLine* line, const OpeningOptions& options)
+{
+    double retVal = 0.0;
+    for(int seat = 0; seat < 2; ++seat)
+    {
+        BotAgent booked(options.searchEvaluations);
+        BotAgent plain(options.searchEvaluations);
+        booked.setOpening(line);
+        plain.setOpening(nullptr);
+        const MatchResult result = seat == 0 ? playMatch(start, booked, plain) : playMatch(start, plain, booked);
+        retVal += result.winner < 0 ? 0.5 : (result.winner == seat ? 1.0 : 0.0);
+        retVal += 1e-4 * (result.queenHp[seat] - result.queenHp[1 - seat]);
+    }
+    return retVal / 2.0;
+}
+
+// Beam search over build orders: every round extends the best lines by one step on one of the sites closest
+// to the queen's start. Returns false when no line beats the plain bot on this map.
+bool searchLine(WorkStealingPool& pool, const OpeningOptions& options, const GameState& start, BookEntry& entry)
+{
+    int queens[2];
+    Simulator::findQueens(start, queens);
+    if(queens[0] < 0 || start.numSites > MAX_SITES)
+    {
+        return false;
+    }
+    const Position queenStart = start.unitPosition(queens[0]);
+    const bool mirrored = OpeningBook::isMirrored(queenStart);
+    const Position queen = OpeningBook::canonicalPosition(queenStart, mirrored);
+    int order[MAX_SITES];
+    OpeningBook::siteOrder(start, mirrored, order);
+
+    std::vector<int> nearest(start.numSites);
+    for(int canonicalSite = 0; canonicalSite < start.numSites; ++canonicalSite)
+    {
+        nearest[canonicalSite] = canonicalSite;
+    }
+    std::sort(nearest.begin(), nearest.end(), [&](int a, int b)
+    {
+        return distanceBetween(queenStart, 0, start.sitePosition(order[a]), 0) < distanceBetween(queenStart, 0, start.sitePosition(order[b]), 0);
+    });
+    nearest.resize(std::min<int>(nearest.size(), options.candidates));
+
+    OpeningLine root = {};
+    root.layoutHash = OpeningBook::layoutHash(start);
+    root.queenX = static_cast<int16_t>(queen.x);
+    root.queenY = static_cast<int16_t>(queen.y);
+
+    entry.plainScore = scoreLine(start, nullptr, options);
+    entry.score = entry.plainScore;
+    bool found = false;
+    std::vector<ScoredLine> beam(1, ScoredLine{root, entry.plainScore});
+    std::vector<ScoredLine> children;
+    const int maxSteps = std::min(options.maxSteps, OPENING_MAX_STEPS);
+    for(int depth = 0; depth < maxSteps; ++depth)
+    {
+        children.clear();
+        for(const ScoredLine& parent : beam)
+        {
+            for(int canonicalSite : nearest)
+            {
+                bool used = false;
+                for(int step = 0; step < parent.line.nbSteps; ++step)
+                {
+                    used |= (parent.line.steps[step] >> 3) == canonicalSite;
+                }
+                if(used)
+                {
+                    continue;
+                }
+                for(StructureType sType : STEP_TYPES)
+                {
+                    if(sType == StructureType::MINE && start.sites.gold[order[canonicalSite]] == 0)
+                    {
+                        continue;
+                    }
+                    ScoredLine child = parent;
+                    child.line.steps[child.line.nbSteps++] = OpeningBook::packStep(canonicalSite, sType);
+                    children.push_back(child);
+                }
+            }
+        }
+        if(children.empty())
+        {
+            break;
+        }
+        for(ScoredLine& child : children)
+        {
+            pool.submit([&]()
+            {
+                child.score = scoreLine(start, &child.line, options);
+            });
+        }
+        pool.wait();
+        std::stable_sort(children.begin(), children.end(), [](const ScoredLine& a, const ScoredLine& b) { return a.score > b.score; });
+        if(children.front().score > entry.score)
+        {
+            entry.line = children.front().line;
+            entry.score = children.front().score;
+            found = true;
+        }
+        children.resize(std::min<int>(children.size(), options.beamWidth));
+        beam.swap(children);
+    }
+    return found;
+}
+
+// Turn 0 of a recorded match as a full match state. The recorded player sat on seat 0; hidden site gold is
+// filled in with the arena's averages and the enemy starts with our gold.
+bool captureStart(const std::string& path, GameState& start)
+{
+    CaptureFile capture;
+    CaptureTurn turn;
+    if(!capture.open(path) || !capture.nextTurn(turn))
+    {
+        return false;
+    }
+    start = turn.state;
+    start.gold[1] = start.gold[0];
+    for(int siteId = 0; siteId < start.numSites; ++siteId)
+    {
+        if(start.sites.gold[siteId] < 0)
+        {
+            start.sites.gold[siteId] = (ARENA_MIN_SITE_GOLD + ARENA_MAX_SITE_GOLD) / 2;
+        }
+        if(start.sites.maxMineSize[siteId] < 0)
+        {
+            start.sites.maxMineSize[siteId] = (1 + ARENA_MAX_MINE_SIZE) / 2;
+        }
+    }
+    return true;
+}
+
+// The bot ships as one file, so the book lives in it: the lines between its two markers are replaced.
+bool writeBook(const std::string& path, std::vector<BookEntry>& entries)
+{
+    static const std::string beginMarker = "// BEGIN OPENING BOOK\n";
+    static const std::string endMarker = "// END OPENING BOOK\n";
+    std::ifstream in(path, std::ios::binary);
+    const std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t begin = source.find(beginMarker);
+    const size_t end = source.find(endMarker);
+    if(begin == std::string::npos || end == std::string::npos || end < begin)
+    {
+        return false;
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const BookEntry& a, const BookEntry& b)
+    {
+        return a.line.layoutHash < b.line.layoutHash;
+    });
+    std::string book;
+    char line[160];
+    std::snprintf(line, sizeof(line), "// %d lines, each scoring better than the plain bot on its map.\n", static_cast<int>(entries.size()));
+    book += line;
+    book += "constexpr OpeningLine OPENING_BOOK[] =\n{\n";
+    for(const BookEntry& entry : entries)
+    {
+        const OpeningLine& opening = entry.line;
+        std::snprintf(line, sizeof(line), "    {0x%016llxull, %d, %d, %d, {", static_cast<unsigned long long>(opening.layoutHash),
+                      opening.queenX, opening.queenY, opening.nbSteps);
+        book += line;
+        for(int step = 0; step < opening.nbSteps; ++step)
+        {
+            std::snprintf(line, sizeof(line), step ? ", 0x%02x" : "0x%02x", opening.steps[step]);
+            book += line;
+        }
+        std::snprintf(line, sizeof(line), "}},  // %.3f vs %.3f\n", entry.score, entry.plainScore);
+        book += line;
+    }
+    book += "};\n";
+    book += "constexpr int OPENING_BOOK_SIZE = sizeof(OPENING_BOOK) / sizeof(OPENING_BOOK[0]);\n";
+
+    const std::string updated = source.substr(0, begin + beginMarker.size()) + book + source.substr(end);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if(!file)
+    {
+        return false;
+    }
+    std::fwrite(updated.data(), 1, updated.size(), file);
+    return std::fclose(file) == 0;
+}
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options] [capture file or directory]...\n"
+                 "  Searches opening build orders on generated maps and on the maps of recorded matches,\n"
+                 "  and writes the ones beating the plain bot into the bot's source, between its opening book markers.\n"
+                 "  --layouts N       generated maps (default 20)\n"
+                 "  --seed N          first map seed (default 1)\n"
+                 "  --threads N       worker threads (default: all cores)\n"
+                 "  --search-evals N  search evaluations per turn in the scoring matches (default 0)\n"
+                 "  --steps N         longest build order, at most %d (default 6)\n"
+                 "  --candidates N    sites closest to the queen a step may build on (default 8)\n"
+                 "  --beam N          build orders kept per step (default 3)\n"
+                 "  --output PATH     bot source to update (default coderoyale.cpp)\n",
+                 program, OPENING_MAX_STEPS);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    OpeningOptions options;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        const bool hasValue = arg + 1 < argc;
+        if(option == "--layouts" && hasValue)
+        {
+            options.layouts = std::max(0, std::atoi(argv[++arg]));
+        }
+        else if(option == "--seed" && hasValue)
+        {
+            options.seed = std::strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(option == "--threads" && hasValue)
+        {
+            options.nbThreads = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--search-evals" && hasValue)
+        {
+            options.searchEvaluations = std::atoi(argv[++arg]);
+        }
+        else if(option == "--steps" && hasValue)
+        {
+            options.maxSteps = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--candidates" && hasValue)
+        {
+            options.candidates = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--beam" && hasValue)
+        {
+            options.beamWidth = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--output" && hasValue)
+        {
+            options.output = argv[++arg];
+        }
+        else if(option.compare(0, 1, "-") != 0)
+        {
+            options.captures.push_back(option);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return option == "-h" || option == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<GameState> starts;
+    for(int layout = 0; layout < options.layouts; ++layout)
+    {
+        starts.push_back(generateMatch(options.seed + layout));
+    }
+    for(const std::string& file : collectCaptureFiles(options.captures))
+    {
+        GameState start;
+        if(captureStart(file, start))
+        {
+            starts.push_back(start);
+        }
+        else
+        {
+            std::fprintf(stderr, "skipping %s: not a readable capture\n", file.c_str());
+        }
+    }
+
+    WorkStealingPool pool(options.nbThreads);
+    std::vector<BookEntry> entries;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for(size_t layout = 0; layout < starts.size(); ++layout)
+    {
+        BookEntry entry;
+        const bool found = searchLine(pool, options, starts[layout], entry);
+        bool duplicate = false;
+        for(const BookEntry& other : entries)
+        {
+            duplicate |= other.line.layoutHash == entry.line.layoutHash && other.line.queenX == entry.line.queenX && other.line.queenY == entry.line.queenY;
+        }
+        if(found && !duplicate)
+        {
+            entries.push_back(entry);
+        }
+        std::printf("map %3d: %s, %.3f against the plain bot's %.3f\n", static_cast<int>(layout) + 1,
+                    found ? (duplicate ? "duplicate" : "line found") : "no line", entry.score, entry.plainScore);
+        std::fflush(stdout);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::printf("%d lines for %d maps in %.1f s\n", static_cast<int>(entries.size()), static_cast<int>(starts.size()), seconds);
+
+    if(entries.empty())
+    {
+        std::printf("no opening beat the plain bot, %s left untouched\n", options.output.c_str());
+        return 0;
+    }
+    if(!writeBook(options.output, entries))
+    {
+        std::fprintf(stderr, "could not update the opening book in %s\n", options.output.c_str());
+        return 1;
+    }
+    std::printf("updated the opening book in %s\n", options.output.c_str());
+    return 0;
+}
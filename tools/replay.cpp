@@ -0,0 +1,105 @@
+#include "capture.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [--search-evals N] <capture file or directory>...\n"
+                 "  Re-runs GameContext::takeAction on every captured turn and compares the commands.\n"
+                 "  --search-evals N  sequences the beam search may score per turn (default 0, -1 for time bound)\n",
+                 program);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int searchEvaluations = 0;
+    std::vector<std::string> paths;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        if(option == "--search-evals" && arg + 1 < argc)
+        {
+            searchEvaluations = std::atoi(argv[++arg]);
+        }
+        else if(option == "-h" || option == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            paths.emplace_back(option);
+        }
+    }
+    const std::vector<std::string> files = collectCaptureFiles(paths);
+    if(files.empty())
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    long nbTurns = 0;
+    long nbMatching = 0;
+    int nbFiles = 0;
+    uint64_t phaseTotal[TurnDeadline::nbPhases] = {};
+    uint32_t phaseMax[TurnDeadline::nbPhases] = {};
+    std::chrono::steady_clock::duration replayTime = std::chrono::steady_clock::duration::zero();
+
+    CaptureTurn turn;
+    for(const std::string& file : files)
+    {
+        CaptureFile capture;
+        if(!capture.open(file))
+        {
+            std::fprintf(stderr, "skipping %s: not a capture file\n", file.c_str());
+            continue;
+        }
+        ++nbFiles;
+
+        GameContext game(-1, -1);
+        game.setSearchEvaluationLimit(searchEvaluations);
+        game.loadSites(capture.layout());
+        while(capture.nextTurn(turn))
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const bool played = game.playTurn(turn.state);
+            replayTime += std::chrono::steady_clock::now() - start;
+            if(!played)
+            {
+                break;
+            }
+            ++nbTurns;
+            if(game.getCommands() == turn.commands)
+            {
+                ++nbMatching;
+            }
+            for(int phase = 0; phase < TurnDeadline::nbPhases; ++phase)
+            {
+                phaseTotal[phase] += turn.phaseMicros[phase];
+                phaseMax[phase] = std::max(phaseMax[phase], turn.phaseMicros[phase]);
+            }
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(replayTime).count();
+    std::printf("files %d, turns %ld, replay %.3f s, %.0f turns/s\n",
+                nbFiles, nbTurns, seconds, seconds > 0.0 ? nbTurns / seconds : 0.0);
+    std::printf("commands matching the capture: %ld/%ld (%.1f%%)\n",
+                nbMatching, nbTurns, nbTurns > 0 ? 100.0 * nbMatching / nbTurns : 0.0);
+    static const char* phaseNames[TurnDeadline::nbPhases] = {"parse", "evaluate", "search", "emit"};
+    for(int phase = 0; phase < TurnDeadline::nbPhases; ++phase)
+    {
+        std::printf("captured %-8s avg %8.1f us, max %6u us\n", phaseNames[phase],
+                    nbTurns > 0 ? static_cast<double>(phaseTotal[phase]) / nbTurns : 0.0, phaseMax[phase]);
+    }
+    return 0;
+}
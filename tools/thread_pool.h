@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Each worker owns a deque: it runs its own tasks newest first and, once idle, steals the oldest task of another worker.
+// Tasks are submitted round-robin, so uneven task lengths (short and long matches) are balanced by stealing.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int nbThreads) : _queues(std::max(1, nbThreads)), _nextQueue(0), _queued(0), _pending(0), _stop(false)
+    {
+        for(int worker = 0; worker < static_cast<int>(_queues.size()); ++worker)
+        {
+            _threads.emplace_back([this, worker]() { workerLoop(worker); });
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for(std::thread& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    inline int size() const { return static_cast<int>(_threads.size()); }
+
+    // Called from a single thread, the one that later waits.
+    void submit(std::function<void()> task)
+    {
+        Queue& queue = _queues[_nextQueue++ % _queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            ++_queued;
+            ++_pending;
+        }
+        _wake.notify_one();
+    }
+
+    // Blocks until every submitted task has run.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _done.wait(lock, [this]() { return _pending == 0; });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool takeTask(int worker, std::function<void()>& task)
+    {
+        const int nbQueues = static_cast<int>(_queues.size());
+        for(int offset = 0; offset < nbQueues; ++offset)
+        {
+            Queue& queue = _queues[(worker + offset) % nbQueues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.tasks.empty())
+            {
+                continue;
+            }
+            if(offset == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(int worker)
+    {
+        std::function<void()> task;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                _wake.wait(lock, [this]() { return _stop || _queued > 0; });
+                if(_queued == 0)
+                {
+                    return;
+                }
+                --_queued;
+            }
+            // _queued counted the task, so one is guaranteed to be found in some deque.
+            while(!takeTask(worker, task))
+            {
+                std::this_thread::yield();
+            }
+            task();
+            task = nullptr;
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            if(--_pending == 0)
+            {
+                _done.notify_all();
+            }
+        }
+    }
+
+    std::vector<Queue> _queues;
+    std::vector<std::thread> _threads;
+    size_t _nextQueue;
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    int _queued;
+    int _pending;
+    bool _stop;
+};
@@ -0,0 +1,257 @@
+#include "match.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct ParamRange
+{
+    const char* name;
+    int StrategyParams::*field;
+    int minValue;
+    int maxValue;
+    double step;  // perturbation size of SPSA, in parameter units
+};
+
+// In declaration order of StrategyParams, which is the order the header is written in.
+const ParamRange PARAM_RANGES[] =
+{
+    {"nbEnemyTowersTriggerGiant", &StrategyParams::nbEnemyTowersTriggerGiant, 1, 12, 1.0},
+    {"nbFriendlyTowersMax", &StrategyParams::nbFriendlyTowersMax, 0, 10, 1.0},
+    {"nbArchersMax", &StrategyParams::nbArchersMax, 0, 6, 1.0},
+    {"minAvgArcherHp", &StrategyParams::minAvgArcherHp, 0, 45, 3.0},
+    {"queenSafeRange", &StrategyParams::queenSafeRange, 0, 300, 20.0},
+    {"towerDesiredHp", &StrategyParams::towerDesiredHp, TOWER_HP_INITIAL, TOWER_HP_MAXIMUM, 40.0},
+    {"mineKnightDistance", &StrategyParams::mineKnightDistance, 0, 400, 20.0},
+    {"barracksKnightDistance", &StrategyParams::barracksKnightDistance, 0, 400, 20.0},
+    {"queenHpPerStartingMine", &StrategyParams::queenHpPerStartingMine, 5, 60, 4.0},
+    {"forecastSafetyTurns", &StrategyParams::forecastSafetyTurns, 0, CreepForecast::horizon, 1.0},
+    {"knightWaveLeadTurns", &StrategyParams::knightWaveLeadTurns, 0, 30, 2.0},
+};
+constexpr int NB_PARAMS = sizeof(PARAM_RANGES) / sizeof(PARAM_RANGES[0]);
+static_assert(sizeof(StrategyParams) == NB_PARAMS * sizeof(int), "every strategy parameter needs a range");
+
+// SPSA works on real values measured in steps; parameters are rounded and clamped only when played.
+StrategyParams toParams(const std::vector<double>& theta)
+{
+    StrategyParams retVal = STRATEGY_PARAMS;
+    for(int param = 0; param < NB_PARAMS; ++param)
+    {
+        const ParamRange& range = PARAM_RANGES[param];
+        const int value = static_cast<int>(std::lround(theta[param] * range.step));
+        retVal.*range.field = std::min(range.maxValue, std::max(range.minValue, value));
+    }
+    return retVal;
+}
+
+std::vector<double> toTheta(const StrategyParams& params)
+{
+    std::vector<double> retVal(NB_PARAMS);
+    for(int param = 0; param < NB_PARAMS; ++param)
+    {
+        retVal[param] = params.*PARAM_RANGES[param].field / PARAM_RANGES[param].step;
+    }
+    return retVal;
+}
+
+struct TunerOptions
+{
+    int iterations = 50;
+    int gamesPerIteration = 32;
+    int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t seed = 1;
+    int searchEvaluations = 0;
+    int validationGames = 200;
+    double learningRate = 4.0;
+    std::string output = "tuned_params.h";
+};
+
+// Score of a against b over nbGames matches (maps played twice, sides swapped): 1 for a win, 0.5 for a draw.
+double playBatch(WorkStealingPool& pool, const TunerOptions& options, uint64_t firstSeed, int nbGames,
+                 const StrategyParams& a, const StrategyParams& b)
+{
+    std::vector<double> scores(nbGames, 0.0);
+    for(int game = 0; game < nbGames; ++game)
+    {
+        pool.submit([&, game]()
+        {
+            BotAgent agentA(options.searchEvaluations, a);
+            BotAgent agentB(options.searchEvaluations, b);
+            const uint64_t seed = firstSeed + game / 2;
+            const bool swapped = game % 2 == 1;
+            const MatchResult result = swapped ? playMatch(seed, agentB, agentA) : playMatch(seed, agentA, agentB);
+            const int sideA = swapped ? 1 : 0;
+            scores[game] = result.winner < 0 ? 0.5 : (result.winner == sideA ? 1.0 : 0.0);
+        });
+    }
+    pool.wait();
+    double sum = 0.0;
+    for(double score : scores)
+    {
+        sum += score;
+    }
+    return sum / nbGames;
+}
+
+bool writeHeader(const std::string& path, const StrategyParams& params, double score, int nbGames)
+{
+    FILE* file = std::fopen(path.c_str(), "w");
+    if(!file)
+    {
+        return false;
+    }
+    std::fprintf(file, "#pragma once\n\n");
+    std::fprintf(file, "// Generated by tools/tuner - scored %.1f%% against the previous parameters over %d games.\n", 100.0 * score, nbGames);
+    std::fprintf(file, "constexpr StrategyParams STRATEGY_PARAMS =\n{\n");
+    for(int param = 0; param < NB_PARAMS; ++param)
+    {
+        char value[16];
+        std::snprintf(value, sizeof(value), "%d,", params.*PARAM_RANGES[param].field);
+        std::fprintf(file, "    %-6s// %s\n", value, PARAM_RANGES[param].name);
+    }
+    std::fprintf(file, "};\n");
+    return std::fclose(file) == 0;
+}
+
+void printParams(const char* label, const StrategyParams& params)
+{
+    std::printf("%s", label);
+    for(int param = 0; param < NB_PARAMS; ++param)
+    {
+        std::printf(" %s=%d", PARAM_RANGES[param].name, params.*PARAM_RANGES[param].field);
+    }
+    std::printf("\n");
+}
+
+void printUsage(const char* program)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  Tunes StrategyParams with SPSA over self-play and writes the result as a constexpr header.\n"
+                 "  --iterations N        SPSA iterations (default 50)\n"
+                 "  --games N             games per iteration, even (default 32)\n"
+                 "  --validation-games N  final games of the result against the starting point (default 200)\n"
+                 "  --threads N           worker threads (default: all cores)\n"
+                 "  --seed N              first map seed (default 1)\n"
+                 "  --search-evals N      search evaluations per turn, 0 tunes the greedy chain alone (default 0)\n"
+                 "  --learning-rate X     SPSA gain a (default 4)\n"
+                 "  --output PATH         header to write (default tuned_params.h)\n",
+                 program);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    TunerOptions options;
+    for(int arg = 1; arg < argc; ++arg)
+    {
+        const std::string option = argv[arg];
+        const bool hasValue = arg + 1 < argc;
+        if(option == "--iterations" && hasValue)
+        {
+            options.iterations = std::atoi(argv[++arg]);
+        }
+        else if(option == "--games" && hasValue)
+        {
+            options.gamesPerIteration = std::max(2, std::atoi(argv[++arg]) / 2 * 2);
+        }
+        else if(option == "--validation-games" && hasValue)
+        {
+            options.validationGames = std::max(2, std::atoi(argv[++arg]) / 2 * 2);
+        }
+        else if(option == "--threads" && hasValue)
+        {
+            options.nbThreads = std::max(1, std::atoi(argv[++arg]));
+        }
+        else if(option == "--seed" && hasValue)
+        {
+            options.seed = std::strtoull(argv[++arg], nullptr, 10);
+        }
+        else if(option == "--search-evals" && hasValue)
+        {
+            options.searchEvaluations = std::atoi(argv[++arg]);
+        }
+        else if(option == "--learning-rate" && hasValue)
+        {
+            options.learningRate = std::atof(argv[++arg]);
+        }
+        else if(option == "--output" && hasValue)
+        {
+            options.output = argv[++arg];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return option == "-h" || option == "--help" ? 0 : 1;
+        }
+    }
+
+    WorkStealingPool pool(options.nbThreads);
+    std::mt19937_64 rng(options.seed);
+    const StrategyParams start = STRATEGY_PARAMS;
+    std::vector<double> theta = toTheta(start);
+    std::vector<double> thetaPlus(NB_PARAMS);
+    std::vector<double> thetaMinus(NB_PARAMS);
+    std::vector<double> delta(NB_PARAMS);
+
+    // Standard SPSA gain sequences (Spall), with the perturbation fixed at one step of each parameter.
+    const double stability = 0.1 * options.iterations;
+    uint64_t nextSeed = options.seed * 1000003;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    for(int iteration = 0; iteration < options.iterations; ++iteration)
+    {
+        const double gain = options.learningRate / std::pow(iteration + 1 + stability, 0.602);
+        const double perturbation = 1.0 / std::pow(iteration + 1, 0.101);
+        for(int param = 0; param < NB_PARAMS; ++param)
+        {
+            delta[param] = (rng() & 1) ? 1.0 : -1.0;
+            thetaPlus[param] = theta[param] + perturbation * delta[param];
+            thetaMinus[param] = theta[param] - perturbation * delta[param];
+        }
+        const double score = playBatch(pool, options, nextSeed, options.gamesPerIteration, toParams(thetaPlus), toParams(thetaMinus));
+        nextSeed += options.gamesPerIteration / 2;
+        // score - 0.5 estimates half the difference of the two sides' expected scores
+        for(int param = 0; param < NB_PARAMS; ++param)
+        {
+            theta[param] += gain * (score - 0.5) / (perturbation * delta[param]);
+        }
+        // keep theta inside the ranges so the gradient is not lost to clamping
+        for(int param = 0; param < NB_PARAMS; ++param)
+        {
+            const ParamRange& range = PARAM_RANGES[param];
+            theta[param] = std::min(range.maxValue / range.step, std::max(range.minValue / range.step, theta[param]));
+        }
+        std::printf("iteration %3d: plus side scored %.1f%%\n", iteration + 1, 100.0 * score);
+        std::fflush(stdout);
+    }
+
+    const StrategyParams tuned = toParams(theta);
+    const double validation = playBatch(pool, options, nextSeed, options.validationGames, tuned, start);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    const int nbGames = options.iterations * options.gamesPerIteration + options.validationGames;
+    printParams("start:", start);
+    printParams("tuned:", tuned);
+    std::printf("tuned vs start: %.1f%% over %d games\n", 100.0 * validation, options.validationGames);
+    std::printf("%d games on %d threads in %.1f s, %.1f games/s\n", nbGames, pool.size(), seconds, nbGames / seconds);
+
+    if(validation < 0.5)
+    {
+        std::printf("tuned parameters did not beat the starting point, %s left untouched\n", options.output.c_str());
+        return 0;
+    }
+    if(!writeHeader(options.output, tuned, validation, options.validationGames))
+    {
+        std::fprintf(stderr, "could not write %s\n", options.output.c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", options.output.c_str());
+    return 0;
+}